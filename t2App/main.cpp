@@ -1,22 +1,99 @@
 #include <QCoreApplication>
+#include <QCommandLineParser>
 #include <QDebug>
 
 #include "mqhttp.h"
 #include "mqcouch.h"
+#include "mqload.h"
 
 #include <QJsonDocument>
 #include <QPair>
 
-mqhttp *_mqhttp;
-mqcouch *_mqcouch;
+#include <cstdio>
 
 int main(int argc, char *argv[])
 {
     QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("t2App");
 
-    _mqhttp = new mqhttp();
+    QCommandLineParser parser;
+    parser.setApplicationDescription("CouchDB load generator, YCSB style workloads through mqcouch");
+    parser.addHelpOption();
+    parser.addOptions({
+        { "url", "Server url, comma separated node urls of a cluster.", "url", "http://localhost:5984" },
+        { "database", "Benchmark database, recreated unless --no-load is given.", "name", "mqload" },
+        { "workload", "YCSB mix: a (50/50 read/update), b (95/5), c (read only), d (95/5 read/insert), "
+                      "e (95/5 scan/insert) or w (50/50 insert/remove).", "name", "a" },
+        { "read", "Weight of getDocument, overrides --workload.", "weight" },
+        { "update", "Weight of updateDocument.", "weight" },
+        { "insert", "Weight of addDocument.", "weight" },
+        { "remove", "Weight of removeDocument.", "weight" },
+        { "scan", "Weight of getDocumentList.", "weight" },
+        { "concurrency", "Worker threads, each runs one operation at a time.", "threads", "8" },
+        { "duration", "Seconds of measured load.", "seconds", "30" },
+        { "records", "Documents loaded before the run.", "count", "10000" },
+        { "no-load", "Reuse documents of a previous run." },
+        { "size-min", "Smallest document body in bytes.", "bytes", "1024" },
+        { "size-max", "Largest document body in bytes, sizes are uniform in between.", "bytes", "1024" },
+        { "keys", "Key distribution, uniform, zipfian or latest (default of workload d).", "distribution", "zipfian" },
+        { "scan-length", "Rows read by a scan.", "rows", "100" },
+        { "seed", "Seed of keys, sizes and the operation mix.", "seed", "1" },
+        { "metrics", "Print per-request metrics in json or prometheus format.", "format" }
+    });
+    parser.process(a);
 
-    /* code */
+    _mq_loadOptions options;
+    options.url = parser.value("url");
+    options.database = parser.value("database");
+    options.concurrency = qMax(1, parser.value("concurrency").toInt());
+    options.duration = qMax(1, parser.value("duration").toInt());
+    options.records = qMax(1, parser.value("records").toInt());
+    options.load = NOT parser.isSet("no-load");
+    options.sizeMin = qMax(0, parser.value("size-min").toInt());
+    options.sizeMax = parser.value("size-max").toInt();
+    options.scanLength = qMax(1, parser.value("scan-length").toInt());
+    options.seed = parser.value("seed").toUInt();
+
+    if(parser.value("keys") == "uniform")
+        options.keys = DISTRIBUTION_UNIFORM;
+    else if(parser.value("keys") == "latest")
+        options.keys = DISTRIBUTION_LATEST;
+    else if(parser.value("keys") != "zipfian")
+        parser.showHelp(1);
+
+    //YCSB D reads what was just inserted
+    if(NOT parser.isSet("keys") && parser.value("workload").toLower() == "d")
+        options.keys = DISTRIBUTION_LATEST;
+
+    if(NOT mqload::workloadMix(parser.value("workload"), options.mix))
+        parser.showHelp(1);
+
+    //Explicit weights replace the whole mix
+    const char *weights[] = { "read", "update", "insert", "remove", "scan" };
+    bool custom = false;
+    for(const char *weight : weights)
+        custom = custom || parser.isSet(weight);
+
+    double total = 0;
+    for(int op = 0; op <= LOAD_SCAN; op++)
+    {
+        if(custom)
+            options.mix[op] = qMax(0.0, parser.value(weights[op]).toDouble());
+        total += options.mix[op];
+    }
+
+    if(total <= 0)
+        parser.showHelp(1);
+
+    mqload load(options);
+    QJsonDocument report = load.run();
+
+    printf("%s\n", report.toJson().constData());
+
+    if(parser.value("metrics") == "json")
+        printf("%s\n", load.metrics().toJson().toJson().constData());
+    else if(parser.value("metrics") == "prometheus")
+        printf("%s", load.metrics().toPrometheus().constData());
 
     return 0;
-}
\ No newline at end of file
+}
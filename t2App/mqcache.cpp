@@ -0,0 +1,108 @@
+/**
+ *  @file    mqcache.cpp
+ *
+ *  @brief Client-side document cache
+ *
+ *  @section DESCRIPTION
+ *
+ *  LRU cache of documents with their ETags, used by mqcouch::getDocument
+ *  to revalidate repeat reads with If-None-Match
+ */
+
+#include "mqcache.h"
+
+mqcache::mqcache(int maxEntries, qint64 maxBytes)
+{
+    m_maxEntries = maxEntries;
+    m_maxBytes = maxBytes;
+}
+
+void mqcache::setLimits(int maxEntries, qint64 maxBytes)
+{
+    m_maxEntries = maxEntries;
+    m_maxBytes = maxBytes;
+    evict();
+}
+
+bool mqcache::lookup(const QString &database, const QString &id, _mq_cacheEntry *entry)
+{
+    auto it = m_entries.find(key(database, id));
+    if(it == m_entries.end())
+        return false;
+
+    //Move to the front of the LRU order
+    m_order.splice(m_order.begin(), m_order, it->position);
+
+    *entry = it->entry;
+    return true;
+}
+
+void mqcache::insert(const QString &database, const QString &id, const _mq_cacheEntry &entry)
+{
+    const QString _key = key(database, id);
+    remove(_key);
+
+    //Documents larger than the whole cache are never kept
+    if(entry.raw.size() > m_maxBytes || m_maxEntries <= 0)
+        return;
+
+    m_order.push_front(_key);
+
+    _mq_cacheNode node;
+    node.entry = entry;
+    node.position = m_order.begin();
+
+    m_entries.insert(_key, node);
+    m_bytes += entry.raw.size();
+
+    evict();
+}
+
+void mqcache::invalidate(const QString &database, const QString &id)
+{
+    remove(key(database, id));
+}
+
+void mqcache::invalidateDatabase(const QString &database)
+{
+    const QString prefix = database + "/";
+
+    for(const QString &_key : m_entries.keys())
+    {
+        if(_key.startsWith(prefix))
+            remove(_key);
+    }
+}
+
+void mqcache::clear()
+{
+    m_entries.clear();
+    m_order.clear();
+    m_bytes = 0;
+}
+
+QString mqcache::key(const QString &database, const QString &id)
+{
+    return database + "/" + id;
+}
+
+void mqcache::remove(const QString &key)
+{
+    auto it = m_entries.find(key);
+    if(it == m_entries.end())
+        return;
+
+    m_bytes -= it->entry.raw.size();
+    m_order.erase(it->position);
+    m_entries.erase(it);
+}
+
+void mqcache::evict()
+{
+    while(NOT m_order.empty() && (m_entries.count() > m_maxEntries || m_bytes > m_maxBytes))
+    {
+        const QString oldest = m_order.back();
+        remove(oldest);
+        m_evictions++;
+    }
+}
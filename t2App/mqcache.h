@@ -0,0 +1,79 @@
+#ifndef MQCACHE_H
+#define MQCACHE_H
+
+#include "mqcouch_types.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+#include <list>
+
+typedef struct _mq_cacheEntry{
+    QByteArray etag;
+    QByteArray raw;
+    _mq_documentRaw document;
+} _mq_cacheEntry;
+
+/**
+ * @brief Bounded LRU cache of documents, keyed by database and id
+ *
+ * Entries keep the response bytes, the parsed document and its ETag so repeat
+ * reads can be revalidated with If-None-Match. Size is limited by entry count
+ * and by the raw bytes held, least recently used entries are evicted first.
+ */
+class mqcache
+{
+public:
+    explicit mqcache(int maxEntries = 1000, qint64 maxBytes = 64 * 1024 * 1024);
+
+    void setLimits(int maxEntries, qint64 maxBytes);
+
+    /**
+     * @brief Find a document and mark it as recently used
+     * @return false when the document is not cached
+     */
+    bool lookup(const QString &database, const QString &id, _mq_cacheEntry *entry);
+
+    void insert(const QString &database, const QString &id, const _mq_cacheEntry &entry);
+
+    /// @brief Drop a document, call it after writing the document
+    void invalidate(const QString &database, const QString &id);
+    /// @brief Drop every document of a database
+    void invalidateDatabase(const QString &database);
+    void clear();
+
+    //Counters of getDocument, a hit is a 304 answered from the cache
+    void recordHit() { m_hits++; }
+    void recordMiss() { m_misses++; }
+    quint64 hits() const { return m_hits; }
+    quint64 misses() const { return m_misses; }
+    quint64 evictions() const { return m_evictions; }
+
+    int count() const { return m_entries.count(); }
+    qint64 bytes() const { return m_bytes; }
+
+private:
+    typedef struct _mq_cacheNode{
+        _mq_cacheEntry entry;
+        std::list<QString>::iterator position;
+    } _mq_cacheNode;
+
+    static QString key(const QString &database, const QString &id);
+    void remove(const QString &key);
+    void evict();
+
+    QHash<QString, _mq_cacheNode> m_entries;
+    //Most recently used key first
+    std::list<QString> m_order;
+
+    int m_maxEntries;
+    qint64 m_maxBytes;
+    qint64 m_bytes = 0;
+
+    quint64 m_hits = 0;
+    quint64 m_misses = 0;
+    quint64 m_evictions = 0;
+};
+
+#endif // MQCACHE_H
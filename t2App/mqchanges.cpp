@@ -0,0 +1,266 @@
+/**
+ *  @file    mqchanges.cpp
+ *
+ *  @brief CouchDB _changes feed consumer
+ *
+ *  @section DESCRIPTION
+ *
+ *  Follows normal, longpoll and continuous _changes feeds, emits batches of
+ *  changes and keeps last_seq in a checkpoint file for resuming after restarts
+ */
+
+#include "mqchanges.h"
+
+//Delay before a longpoll/continuous feed reconnects after a failed request
+static const int RECONNECT_DELAY = 5000;
+
+mqchanges::mqchanges(mqhttp *t, QString connectionUrl, QString database, _mq_changesOptions options,
+                     bool debug, QObject *parent) : QObject(parent)
+{
+    //Set private objects
+    m_mqhttp = t;
+    databaseUrl = connectionUrl;
+    m_database = database;
+    m_options = options;
+    showDebug = debug;
+    m_since = options.since;
+
+    m_list << mq_httpHeader{
+              .key = "Content-Type",
+              .value = "application/json"
+            };
+
+    m_watchdog = new QTimer(this);
+    m_watchdog->setSingleShot(true);
+    connect(m_watchdog, &QTimer::timeout, this, [this]()
+    {
+        if(showDebug)
+            qDebug() << "Changes feed is silent, reconnecting" << m_database;
+
+        //Aborting finishes the reply with an error, which schedules the reconnect
+        if(m_ticket)
+            m_mqhttp->abort(m_ticket);
+    });
+
+    m_reconnect = new QTimer(this);
+    m_reconnect->setSingleShot(true);
+    m_reconnect->setInterval(RECONNECT_DELAY);
+    connect(m_reconnect, &QTimer::timeout, this, &mqchanges::request);
+}
+
+mqchanges::~mqchanges()
+{
+    stop();
+    delete m_parser;
+}
+
+void mqchanges::start()
+{
+    if(m_running)
+        return;
+
+    m_running = true;
+    m_generation++;
+    m_reconnect->stop();
+    loadCheckpoint();
+    request();
+}
+
+void mqchanges::stop()
+{
+    m_running = false;
+    //Callbacks of the running request see a new generation and are ignored
+    m_generation++;
+    m_watchdog->stop();
+    m_reconnect->stop();
+
+    if(m_ticket)
+    {
+        const quint64 ticket = m_ticket;
+        m_ticket = 0;
+        m_mqhttp->abort(ticket);
+    }
+}
+
+void mqchanges::request()
+{
+    if(NOT m_running)
+        return;
+
+    const bool continuous = m_options.feed == FEED_CONTINUOUS;
+    const QString feed = continuous ? "continuous" : (m_options.feed == FEED_LONGPOLL ? "longpoll" : "normal");
+
+    const QString node = m_cluster ? m_cluster->select(m_database) : databaseUrl;
+    QString _query = node + "/" + m_database + "/_changes?feed=" + feed + "&since=" + QUrl::toPercentEncoding(m_since);
+
+    if(m_options.limit > 0)
+        _query += "&limit=" + QString::number(m_options.limit);
+    if(m_options.includeDocs)
+        _query += "&include_docs=true";
+    if(m_options.feed != FEED_NORMAL && m_options.heartbeat > 0)
+        _query += "&heartbeat=" + QString::number(m_options.heartbeat);
+
+    QString verb = "GET";
+    QByteArray body;
+
+    if(NOT m_options.selector.isEmpty())
+    {
+        _query += "&filter=_selector";
+        verb = "POST";
+        body = QJsonDocument(QJsonObject{ {"selector", m_options.selector} }).toJson(QJsonDocument::Compact);
+    }
+    else if(NOT m_options.filter.isEmpty())
+        _query += "&filter=" + QUrl::toPercentEncoding(m_options.filter);
+
+    /*
+     * Sample Json (normal, longpoll)
+     * {"results":[{"seq":"3-g1AAAA...","id":"76aa2bb58c4996a414d321e7a80021d3","changes":[{"rev":"1-8ecb908fbedda2e535121a19db7194d6"}]}],
+     *  "last_seq":"3-g1AAAA...","pending":0}
+     *
+     * Continuous feeds send one change object per line and {"last_seq":...} at the end
+    */
+
+    delete m_parser;
+    m_batch.clear();
+    m_parser = new mqrowparser(continuous ? QByteArray() : QByteArray("results"), [this](const QJsonObject &row)
+    {
+        if(row.contains("last_seq"))
+            m_since = toSeq(row["last_seq"]);
+        else
+            m_batch << toChange(row);
+    });
+
+    if(m_options.feed != FEED_NORMAL && m_options.heartbeat > 0)
+        m_watchdog->start(2 * m_options.heartbeat);
+
+    //Cancels of queued requests arrive after stop() or even after deletion
+    QPointer<mqchanges> self(this);
+    const quint64 generation = m_generation;
+
+    m_ticket = m_mqhttp->stream(_query, m_list, verb, body, [this, self, generation, continuous](const QByteArray &chunk, int)
+    {
+        if(NOT self || generation != m_generation)
+            return;
+
+        if(m_options.feed != FEED_NORMAL && m_options.heartbeat > 0)
+            m_watchdog->start(2 * m_options.heartbeat);
+
+        m_parser->feed(chunk);
+
+        if(continuous && NOT m_batch.isEmpty())
+            finishBatch(m_batch.last().seq);
+    }, [this, self, generation, continuous](const mq_reply &reply)
+    {
+        //Stopped or restarted, the aborted reply is ignored
+        if(NOT self || generation != m_generation || NOT m_running)
+            return;
+
+        m_watchdog->stop();
+        m_ticket = 0;
+
+        if(reply.error != QNetworkReply::NoError)
+        {
+            if(showDebug)
+                qDebug() << "Problem on following changes" << reply.errorString << reply.body;
+
+            emit error(reply.errorString);
+            reconnect();
+            return;
+        }
+
+        if(continuous)
+            finishBatch(m_batch.isEmpty() ? QString() : m_batch.last().seq);
+        else
+            finishBatch(toSeq(m_parser->envelope()["last_seq"]));
+
+        if(m_options.feed == FEED_NORMAL)
+        {
+            m_running = false;
+            emit finished(m_since);
+            return;
+        }
+
+        request();
+    });
+}
+
+void mqchanges::finishBatch(const QString &lastSeq)
+{
+    if(NOT lastSeq.isEmpty())
+        m_since = lastSeq;
+
+    const QList<_mq_change> batch = m_batch;
+    m_batch.clear();
+
+    //Checkpoint after delivery, a crash in between replays the batch instead of losing it
+    if(NOT batch.isEmpty())
+        emit changes(batch);
+
+    saveCheckpoint();
+}
+
+void mqchanges::reconnect()
+{
+    if(m_options.feed == FEED_NORMAL)
+    {
+        m_running = false;
+        return;
+    }
+
+    m_reconnect->start();
+}
+
+void mqchanges::loadCheckpoint()
+{
+    if(m_options.checkpointFile.isEmpty())
+        return;
+
+    QFile file(m_options.checkpointFile);
+    if(NOT file.open(QIODevice::ReadOnly))
+        return;
+
+    const QString seq = QString::fromUtf8(file.readAll()).trimmed();
+    if(NOT seq.isEmpty())
+        m_since = seq;
+}
+
+void mqchanges::saveCheckpoint()
+{
+    if(m_options.checkpointFile.isEmpty())
+        return;
+
+    //QSaveFile replaces the old checkpoint only after the new one is fully written
+    QSaveFile file(m_options.checkpointFile);
+    if(file.open(QIODevice::WriteOnly))
+    {
+        file.write(m_since.toUtf8());
+        file.commit();
+    }
+    else if(showDebug)
+        qDebug() << "Checkpoint is not writable!" << m_options.checkpointFile;
+}
+
+_mq_change mqchanges::toChange(const QJsonObject &row)
+{
+    _mq_change change;
+    change.seq = toSeq(row["seq"]);
+    change.id = row["id"].toString();
+    change.deleted = row["deleted"].toBool();
+    change.doc = row["doc"].toObject();
+
+    for(QJsonValue rev : row["changes"].toArray())
+        change.revs << rev.toObject()["rev"].toString();
+
+    return change;
+}
+
+QString mqchanges::toSeq(const QJsonValue &value)
+{
+    //CouchDB 2.x sequences are opaque strings, 1.x uses integers
+    if(value.isString())
+        return value.toString();
+    else if(value.isDouble())
+        return QString::number(value.toVariant().toLongLong());
+
+    return QString();
+}
@@ -0,0 +1,87 @@
+#ifndef MQCHANGES_H
+#define MQCHANGES_H
+
+#include <QObject>
+
+#include "mqhttp.h"
+#include "mqcouch_types.h"
+#include "mqrowparser.h"
+#include "mqcluster.h"
+
+#include <QDebug>
+#include <QList>
+#include <QString>
+#include <QTimer>
+#include <QPointer>
+#include <QUrl>
+
+#include <QFile>
+#include <QSaveFile>
+
+class mqchanges : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief Follow the _changes feed of a database
+     * @param t http client, its scheduler keeps one slot busy while a longpoll/continuous request is open
+     * @param connectionUrl server url, ex. http://localhost:5984
+     * @param database collection name
+     * @param options feed style, filters and checkpoint file
+     */
+    explicit mqchanges(mqhttp *t, QString connectionUrl, QString database, _mq_changesOptions options,
+                       bool debug = true, QObject *parent = 0);
+    ~mqchanges();
+
+    /// @return sequence after the last delivered batch, stored in the checkpoint file
+    QString lastSeq() const { return m_since; }
+
+    bool isRunning() const { return m_running; }
+
+    /// @brief Pick the node of every (re)connect from a cluster instead of connectionUrl
+    void setCluster(mqcluster *cluster) { m_cluster = cluster; }
+
+signals:
+    /// Changes in feed order, the checkpoint is saved after every batch
+    void changes(QList<_mq_change> batch);
+    /// Normal feed reached its end
+    void finished(QString lastSeq);
+    /// Request failed, longpoll and continuous feeds reconnect by themselves
+    void error(QString description);
+
+public slots:
+    void start();
+    void stop();
+
+private:
+    void request();
+    void finishBatch(const QString &lastSeq);
+    void reconnect();
+    void loadCheckpoint();
+    void saveCheckpoint();
+    static _mq_change toChange(const QJsonObject &row);
+    static QString toSeq(const QJsonValue &value);
+
+    mqhttp *m_mqhttp;
+    QList<mq_httpHeader> m_list;
+    QString databaseUrl;
+    QPointer<mqcluster> m_cluster;
+    QString m_database;
+    _mq_changesOptions m_options;
+    bool showDebug;
+
+    QString m_since;
+    QList<_mq_change> m_batch;
+    mqrowparser *m_parser = nullptr;
+    quint64 m_ticket = 0;
+    bool m_running = false;
+
+    //Restarts a continuous feed that stopped sending heartbeats
+    QTimer *m_watchdog;
+    //Delayed request after a failure, stopped by stop()/start()
+    QTimer *m_reconnect;
+    //Bumped by start()/stop(), callbacks of older requests are dropped
+    quint64 m_generation = 0;
+};
+
+#endif // MQCHANGES_H
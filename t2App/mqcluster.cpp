@@ -0,0 +1,250 @@
+/**
+ *  @file    mqcluster.cpp
+ *
+ *  @brief Node selection of a CouchDB cluster
+ *
+ *  @section DESCRIPTION
+ *
+ *  Spreads requests over cluster nodes by outstanding requests or in turn,
+ *  ejects nodes failing their health checks and pins recently written
+ *  databases to one node for read-your-writes
+ */
+
+#include "mqcluster.h"
+
+//Default milliseconds between health checks
+static const int HEALTH_CHECK_INTERVAL = 5000;
+
+mqcluster::mqcluster(mqhttp *t, QStringList nodes, bool debug, QObject *parent) : QObject(parent)
+{
+    m_mqhttp = t;
+    showDebug = debug;
+
+    for(QString url : nodes)
+    {
+        while(url.endsWith('/'))
+            url.chop(1);
+        if(url.isEmpty())
+            continue;
+
+        _mq_node node;
+        node.url = url;
+        m_nodes.append(node);
+    }
+    m_probing.fill(false, m_nodes.count());
+
+    m_clock.start();
+
+    m_timer = new QTimer(this);
+    connect(m_timer, &QTimer::timeout, this, &mqcluster::check);
+    m_timer->start(HEALTH_CHECK_INTERVAL);
+
+    //First round right after the event loop starts
+    QTimer::singleShot(0, this, &mqcluster::check);
+
+    //Retries to other origins, ex. another cluster on the same client, keep their own resolver
+    QStringList origins;
+    for(const _mq_node &node : m_nodes)
+        origins << mqhttp::origin(node.url);
+    m_resolver = m_mqhttp->addNodeResolver(origins, [this](const QString &url) { return failover(url); });
+}
+
+mqcluster::~mqcluster()
+{
+    if(m_mqhttp)
+        m_mqhttp->removeNodeResolver(m_resolver);
+}
+
+QStringList mqcluster::nodes() const
+{
+    QStringList urls;
+    for(const _mq_node &node : m_nodes)
+        urls << node.url;
+    return urls;
+}
+
+int mqcluster::healthyCount() const
+{
+    int count = 0;
+    for(const _mq_node &node : m_nodes)
+    {
+        if(node.healthy)
+            count++;
+    }
+    return count;
+}
+
+void mqcluster::setHealthCheck(int interval, int timeout, int maxFailures)
+{
+    m_checkTimeout = qMax(1, timeout);
+    m_maxFailures = qMax(1, maxFailures);
+
+    if(interval > 0)
+        m_timer->start(interval);
+    else
+        m_timer->stop();
+}
+
+void mqcluster::setStickyReads(int window)
+{
+    m_stickyWindow = qMax(0, window);
+    if(m_stickyWindow == 0)
+        m_pins.clear();
+}
+
+QString mqcluster::select(const QString &database, bool write)
+{
+    if(m_nodes.isEmpty())
+        return QString();
+
+    const bool sticky = m_stickyWindow > 0 && !database.isEmpty();
+    const qint64 now = m_clock.elapsed();
+
+    if(sticky)
+    {
+        auto it = m_pins.find(database);
+        if(it != m_pins.end())
+        {
+            if(it->until > now && m_nodes[it->node].healthy)
+            {
+                if(write)
+                    it->until = now + m_stickyWindow;
+
+                m_nodes[it->node].selected++;
+                return m_nodes[it->node].url;
+            }
+
+            m_pins.erase(it);
+        }
+    }
+
+    const int index = choose();
+    m_nodes[index].selected++;
+
+    if(sticky && write)
+    {
+        _mq_pin pin;
+        pin.node = index;
+        pin.until = now + m_stickyWindow;
+        m_pins.insert(database, pin);
+    }
+
+    return m_nodes[index].url;
+}
+
+int mqcluster::choose(int exclude)
+{
+    const int count = m_nodes.count();
+    const bool anyHealthy = healthyCount() > 0;
+
+    //Rotating start spreads ties and round-robin alike
+    const int start = int(m_next++ % quint32(count));
+
+    int best = -1;
+    int bestOutstanding = 0;
+    for(int i = 0; i < count; i++)
+    {
+        const int index = (start + i) % count;
+        if(index == exclude || (anyHealthy && !m_nodes[index].healthy))
+            continue;
+
+        if(m_policy == BALANCE_ROUND_ROBIN)
+            return index;
+
+        const int outstanding = m_mqhttp->outstanding(m_nodes[index].url);
+        if(best < 0 || outstanding < bestOutstanding)
+        {
+            best = index;
+            bestOutstanding = outstanding;
+        }
+    }
+
+    return best < 0 ? start : best;
+}
+
+QString mqcluster::failover(const QString &url)
+{
+    for(int i = 0; i < m_nodes.count(); i++)
+    {
+        const QString &node = m_nodes[i].url;
+        if(!url.startsWith(node + "/"))
+            continue;
+
+        //Only node, nowhere else to go
+        if(m_nodes.count() == 1)
+            return url;
+
+        const int index = choose(i);
+        if(index == i || !m_nodes[index].healthy)
+            return url;
+
+        if(showDebug)
+            qDebug() << "Retrying on" << m_nodes[index].url << "instead of" << node;
+
+        m_nodes[index].selected++;
+        return m_nodes[index].url + url.mid(node.size());
+    }
+
+    return url;
+}
+
+void mqcluster::check()
+{
+    for(int i = 0; i < m_nodes.count(); i++)
+    {
+        if(!m_probing[i])
+            probe(i);
+    }
+}
+
+void mqcluster::probe(int index)
+{
+    m_probing[index] = true;
+
+    QPointer<mqcluster> self(this);
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    //Outside the retry policy, hedging, in-flight window and metrics of user requests
+    QList<mq_httpHeader> headers;
+    m_mqhttp->probe(m_nodes[index].url + "/", headers, [self, index, elapsed](const mq_reply &reply)
+    {
+        //Cluster was deleted while the check was running
+        if(!self)
+            return;
+
+        const bool ok = reply.error == QNetworkReply::NoError && reply.status == 200
+                && isWelcome(QJsonDocument::fromJson(reply.body).object());
+        self->checked(index, ok, elapsed.nsecsElapsed() / 1000);
+    }, m_checkTimeout);
+}
+
+void mqcluster::checked(int index, bool ok, qint64 latency)
+{
+    m_probing[index] = false;
+    _mq_node &node = m_nodes[index];
+
+    if(ok)
+    {
+        node.failures = 0;
+        node.latency = latency;
+
+        if(!node.healthy)
+        {
+            node.healthy = true;
+            if(showDebug)
+                qDebug() << "Cluster node is back" << node.url;
+            emit nodeUp(node.url);
+        }
+        return;
+    }
+
+    node.failures++;
+    if(node.healthy && node.failures >= m_maxFailures)
+    {
+        node.healthy = false;
+        if(showDebug)
+            qDebug() << "Cluster node ejected after" << node.failures << "failed checks" << node.url;
+        emit nodeDown(node.url);
+    }
+}
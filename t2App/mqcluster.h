@@ -0,0 +1,134 @@
+#ifndef MQCLUSTER_H
+#define MQCLUSTER_H
+
+#include <QObject>
+
+#include "mqhttp.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPointer>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+//How requests are spread over healthy nodes
+enum balancePolicy{
+    //Node with the fewest queued and in-flight requests of this client, ties rotate
+    BALANCE_LEAST_OUTSTANDING = 0,
+    BALANCE_ROUND_ROBIN = 1
+};
+
+typedef struct _mq_node{
+    QString url;
+    bool healthy = true;
+    //Consecutive failed health checks
+    int failures = 0;
+    //Microseconds of the last successful check, -1 before the first one
+    qint64 latency = -1;
+    //Times the node was picked by select()
+    quint64 selected = 0;
+} _mq_node;
+
+/**
+ * @brief Set of CouchDB cluster nodes behind one client
+ *
+ * select() hands out the base url of a healthy node for every request. Nodes
+ * are probed in the background with GET /, the same check as mqcouch::isActive,
+ * and are ejected after consecutive failures and admitted again after one good
+ * check. When every node is down all of them are used, requests fail on their own.
+ * Retries of mqhttp's retry policy move to another healthy node.
+ */
+class mqcluster : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @param t http client used for health checks and asked for outstanding requests,
+     *        the cluster installs its node resolver for the origins of its nodes
+     * @param nodes node urls, ex. http://10.0.0.1:5984
+     */
+    explicit mqcluster(mqhttp *t, QStringList nodes, bool debug = true, QObject *parent = 0);
+    ~mqcluster();
+
+    QStringList nodes() const;
+    /// @return health and selection counters of every node
+    QVector<_mq_node> status() const { return m_nodes; }
+    int healthyCount() const;
+
+    void setPolicy(balancePolicy policy) { m_policy = policy; }
+    balancePolicy policy() const { return m_policy; }
+
+    /**
+     * @brief Configure background health checks
+     * @param interval milliseconds between checks, 0 stops them
+     * @param timeout milliseconds before a check counts as failed
+     * @param maxFailures consecutive failed checks before a node is ejected
+     */
+    void setHealthCheck(int interval, int timeout = 2000, int maxFailures = 2);
+
+    /**
+     * @brief Read your writes: after a write, requests of the same database stay on the node that took it
+     * @param window milliseconds the database stays pinned after its last write, 0 disables (default)
+     * @note the pin moves when its node is ejected
+     */
+    void setStickyReads(int window);
+    int stickyReads() const { return m_stickyWindow; }
+
+    /**
+     * @brief Pick the node for a request
+     * @param database collection the request touches, empty for server requests
+     * @param write request changes the database, pins it when sticky reads are on
+     * @return node url without a trailing slash
+     */
+    QString select(const QString &database = QString(), bool write = false);
+
+    /// @return true for the welcome object of GET /
+    static bool isWelcome(const QJsonObject &entity) { return entity["couchdb"] == "Welcome"; }
+
+signals:
+    /// Node was ejected after failed health checks
+    void nodeDown(QString url);
+    /// Ejected node answered a health check again
+    void nodeUp(QString url);
+
+public slots:
+    /// @brief Probe every node now, nodes with a check still running are skipped
+    void check();
+
+private:
+    typedef struct _mq_pin{
+        int node;
+        qint64 until;
+    } _mq_pin;
+
+    int choose(int exclude = -1);
+    QString failover(const QString &url);
+    void probe(int index);
+    void checked(int index, bool ok, qint64 latency);
+
+    QPointer<mqhttp> m_mqhttp;
+    quint64 m_resolver;
+    QVector<_mq_node> m_nodes;
+    QVector<bool> m_probing;
+    bool showDebug;
+
+    balancePolicy m_policy = BALANCE_LEAST_OUTSTANDING;
+    quint32 m_next = 0;
+
+    QTimer *m_timer;
+    int m_checkTimeout = 2000;
+    int m_maxFailures = 2;
+
+    int m_stickyWindow = 0;
+    //Pinned node of recently written databases
+    QHash<QString, _mq_pin> m_pins;
+    QElapsedTimer m_clock;
+};
+
+#endif // MQCLUSTER_H
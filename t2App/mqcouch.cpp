@@ -26,6 +26,11 @@ mqcouch::mqcouch(mqhttp *t, bool debug, QObject *parent) : QObject(parent)
             };
 }
 
+mqcouch::~mqcouch()
+{
+    delete m_cache;
+}
+
 mqcouch::mqcouch(mqhttp *t, QString connectionUrl, bool debug, QObject *parent) : QObject(parent)
 {
     //Set private objects
@@ -39,9 +44,37 @@ mqcouch::mqcouch(mqhttp *t, QString connectionUrl, bool debug, QObject *parent)
             };
 }
 
+mqcouch::mqcouch(mqhttp *t, QStringList nodes, bool debug, QObject *parent) : QObject(parent)
+{
+    //Set private objects
+    m_mqhttp = t;
+    showDebug = debug;
+    m_cluster = new mqcluster(t, nodes, debug, this);
+
+    if(NOT m_cluster->nodes().isEmpty())
+        databaseUrl = m_cluster->nodes().first();
+
+    m_list << mq_httpHeader{
+              .key = "Content-Type",
+              .value = "application/json"
+            };
+}
+
+QString mqcouch::nodeUrl(const QString &database, bool write)
+{
+    if(m_cluster)
+    {
+        const QString url = m_cluster->select(database, write);
+        if(NOT url.isEmpty())
+            return url;
+    }
+
+    return databaseUrl;
+}
+
 bool mqcouch::createDatabase(QString databaseName)
 {
-    QString _query = databaseUrl + "/" + databaseName;
+    QString _query = nodeUrl(databaseName, true) + "/" + databaseName;
     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "PUT", JSON).toJsonDocument();
 
     QJsonObject entity = doc.object();
@@ -53,13 +86,19 @@ bool mqcouch::createDatabase(QString databaseName)
         return false;
     }
     else
+    {
+        m_knownDatabases.insert(databaseName);
         return true;
+    }
 }
 
 bool mqcouch::removeDatabase(QString databaseName)
 {
-    QString _query = databaseUrl + "/" + databaseName;
+    QString _query = nodeUrl(databaseName, true) + "/" + databaseName;
     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "DELETE", JSON).toJsonDocument();
+    m_knownDatabases.remove(databaseName);
+    if(m_cache)
+        m_cache->invalidateDatabase(databaseName);
 
     QJsonObject entity = doc.object();
     if(entity["result"] == "error")
@@ -75,7 +114,7 @@ bool mqcouch::removeDatabase(QString databaseName)
 
 QJsonObject mqcouch::informationDatabase(QString databaseName)
 {
-    QString _query = databaseUrl + "/" + databaseName;
+    QString _query = nodeUrl(databaseName) + "/" + databaseName;
     //qDebug() << query;
     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
 
@@ -95,7 +134,7 @@ QJsonObject mqcouch::informationDatabase(QString databaseName)
 
 _mq_databaseInfo mqcouch::informationDatabaseStruct(QString databaseName)
 {
-    QString _query = databaseUrl + "/" + databaseName;
+    QString _query = nodeUrl(databaseName) + "/" + databaseName;
     //qDebug() << query;
     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
 
@@ -119,7 +158,7 @@ _mq_databaseInfo mqcouch::informationDatabaseStruct(QString databaseName)
 
 QJsonDocument mqcouch::runDiagQuery(QString query)
 {
-    QString _query = databaseUrl + "/" + query;
+    QString _query = nodeUrl() + "/" + query;
     //qDebug() << query;
     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
 
@@ -138,7 +177,7 @@ QJsonDocument mqcouch::runDiagQuery(QString query)
 
 QString mqcouch::getUuid()
 {
-    QString _query = databaseUrl + "/" + "_uuids";
+    QString _query = nodeUrl() + "/" + "_uuids";
     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
 
     const QJsonObject entity = doc.object();
@@ -154,7 +193,7 @@ QString mqcouch::getUuid()
 
 QStringList mqcouch::getUuids(int limit)
 {
-    QString _query = databaseUrl + "/" + "_uuids?count=" + QString::number(limit);
+    QString _query = nodeUrl() + "/" + "_uuids?count=" + QString::number(limit);
     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
 
     const QJsonObject entity = doc.object();
@@ -176,11 +215,11 @@ QStringList mqcouch::getUuids(int limit)
 
 bool mqcouch::isActive()
 {
-    QString _query = databaseUrl + "/";
+    QString _query = nodeUrl() + "/";
     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
 
     QJsonObject entity = doc.object();
-    if(entity["couchdb"] == "Welcome")
+    if(mqcluster::isWelcome(entity))
     {
         if(showDebug)
         {
@@ -197,34 +236,172 @@ bool mqcouch::isActive()
 
 _mq_documentRaw mqcouch::getDocument(QString database, QString id)
 {
-    QString _query = databaseUrl + "/" + database + "/" + id;
+    QString _query = mq_documentUrl(nodeUrl(database), database, id);
+
+    _mq_cacheEntry cached;
+    const bool revalidate = m_cache && m_cache->lookup(database, id, &cached);
+
+    QList<mq_httpHeader> headers = m_list;
+    if(revalidate)
+        headers << mq_httpHeader{ .key = "If-None-Match", .value = QString::fromLatin1(cached.etag) };
+
+    mq_reply reply = m_mqhttp->exec(_query, headers, "GET");
+
+    return documentFromReply(database, id, reply, revalidate ? &cached : nullptr);
+}
+
+void mqcouch::getDocument(QString database, QString id, mq_documentCallback callback, requestPriority priority)
+{
+    QString _query = mq_documentUrl(nodeUrl(database), database, id);
+
+    _mq_cacheEntry cached;
+    const bool revalidate = m_cache && m_cache->lookup(database, id, &cached);
+
+    QList<mq_httpHeader> headers = m_list;
+    if(revalidate)
+        headers << mq_httpHeader{ .key = "If-None-Match", .value = QString::fromLatin1(cached.etag) };
+
+    m_mqhttp->request(_query, headers, "GET", QByteArray(), [this, database, id, cached, revalidate, callback](const mq_reply &reply)
+    {
+        _mq_cacheEntry entry = cached;
+        _mq_documentRaw data = documentFromReply(database, id, reply, revalidate ? &entry : nullptr);
+
+        if(callback)
+            callback(data);
+    }, priority);
+}
+
+mqdocument mqcouch::getDocumentLazy(QString database, QString id)
+{
+    QString _query = mq_documentUrl(nodeUrl(database), database, id);
+
+    mq_reply reply = m_mqhttp->exec(_query, m_list, "GET");
+    if(reply.error != QNetworkReply::NoError)
+    {
+        if(showDebug)
+            qDebug() << "Problem on getting document" << reply.errorString << reply.body;
+
+        return mqdocument();
+    }
+
+    return mqdocument(reply.body);
+}
+
+void mqcouch::getDocumentLazy(QString database, QString id, mq_lazyDocumentCallback callback, requestPriority priority)
+{
+    QString _query = mq_documentUrl(nodeUrl(database), database, id);
+
+    m_mqhttp->request(_query, m_list, "GET", QByteArray(), [this, callback](const mq_reply &reply)
+    {
+        mqdocument document;
+        if(reply.error == QNetworkReply::NoError)
+            document = mqdocument(reply.body);
+        else if(showDebug)
+            qDebug() << "Problem on getting document" << reply.errorString << reply.body;
+
+        if(callback)
+            callback(document);
+    }, priority);
+}
+
+_mq_documentRaw mqcouch::documentFromReply(const QString &database, const QString &id, const mq_reply &reply, _mq_cacheEntry *cached)
+{
     _mq_documentRaw data;
-    QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
+
+    //Not Modified, the cached body is still the last revision
+    if(cached && reply.status == 304)
+    {
+        //The cache may have been disabled while the request was running
+        if(m_cache)
+            m_cache->recordHit();
+        return cached->document;
+    }
+
+    if(m_cache)
+        m_cache->recordMiss();
+
+    if(reply.error != QNetworkReply::NoError)
+    {
+        if(m_cache)
+            m_cache->invalidate(database, id);
+
+        if(showDebug)
+            qDebug() << "Problem on getting document" << reply.errorString << reply.body;
+
+        return data;
+    }
 
     /*
      * Sample Json
      * {"_id":"76aa2bb58c4996a414d321e7a80021d3","_rev":"1-8ecb908fbedda2e535121a19db7194d6","name":"test22"}
     */
 
+    QJsonDocument doc = QJsonDocument::fromJson(reply.body);
     QJsonObject entity = doc.object();
-    if(entity["result"] != "error")
+
+    data.id = entity["_id"].toString();
+    data.rev = entity["_rev"].toString();
+    data.data = doc;
+
+    const QByteArray etag = mq_replyHeader(reply, "ETag");
+    if(m_cache && NOT etag.isEmpty())
+        m_cache->insert(database, id, _mq_cacheEntry{ .etag = etag, .raw = reply.body, .document = data });
+
+    return data;
+}
+
+void mqcouch::recordRetry(const QString &operation, const QString &database)
+{
+    if(m_mqhttp->metrics())
+        m_mqhttp->metrics()->recordRetry(operation, database);
+}
+
+void mqcouch::invalidateCached(const QString &database, const QString &id)
+{
+    if(m_cache)
+        m_cache->invalidate(database, id);
+}
+
+void mqcouch::setDocumentCache(int maxEntries, qint64 maxBytes)
+{
+    if(maxEntries <= 0 || maxBytes <= 0)
     {
-        data.id = entity["_id"].toString();
-        data.rev = entity["_rev"].toString();
-        data.data = doc;
+        delete m_cache;
+        m_cache = nullptr;
+        return;
+    }
 
-        return data;
+    if(m_cache)
+        m_cache->setLimits(maxEntries, maxBytes);
+    else
+        m_cache = new mqcache(maxEntries, maxBytes);
+}
+
+QString mqcouch::getRevision(QString database, QString id)
+{
+    QString _query = mq_documentUrl(nodeUrl(database), database, id);
+
+    //HEAD has no body, the ETag header carries the last revision ex. "1-8ecb908fbedda2e535121a19db7194d6"
+    mq_reply reply = m_mqhttp->exec(_query, m_list, "HEAD");
+
+    if(reply.error != QNetworkReply::NoError)
+    {
+        if(showDebug)
+            qDebug() << "Problem on getting revision" << reply.errorString;
+
+        return QString();
     }
 
-    if(showDebug)
-        qDebug() << doc.object();
+    QByteArray etag = mq_replyHeader(reply, "ETag");
+    if(etag.startsWith('"') && etag.endsWith('"') && etag.size() >= 2)
+        etag = etag.mid(1, etag.size() - 2);
 
-    return data;
+    return QString::fromLatin1(etag);
 }
 
 _mq_documentRaw mqcouch::getDocumentRevision(QString database, QString id, QString request_rev)
 {
-    QString _query = databaseUrl + "/" + database + "/" + id + "?rev=" + request_rev;
+    QString _query = mq_documentUrl(nodeUrl(database), database, id, "rev=" + request_rev);
     _mq_documentRaw data;
     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
 
@@ -249,27 +426,75 @@ _mq_documentRaw mqcouch::getDocumentRevision(QString database, QString id, QStri
     return data;
 }
 
-QList<_mq_document> mqcouch::getDocumentList(QString database)
+QList<_mq_documentRaw> mqcouch::getDocuments(QString database, QStringList ids)
 {
-    QString _query = databaseUrl + "/" + database + "/_all_docs";
-    QList<_mq_document> data;
-    QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
+    QJsonArray docs;
+    for(const QString &id : ids)
+        docs.append(QJsonObject{ {"id", id} });
+
+    return bulkGet(database, docs);
+}
+
+QList<_mq_documentRaw> mqcouch::getDocumentsRevision(QString database, QList<_mq_document> documents)
+{
+    QJsonArray docs;
+    for(const _mq_document &document : documents)
+        docs.append(QJsonObject{ {"id", document.id}, {"rev", document.rev} });
+
+    return bulkGet(database, docs);
+}
+
+QList<_mq_documentRaw> mqcouch::bulkGet(QString database, QJsonArray docs)
+{
+    QString _query = nodeUrl(database) + "/" + database + "/_bulk_get";
+    QList<_mq_documentRaw> data;
+
+    const QByteArray body = QJsonDocument(QJsonObject{ {"docs", docs} }).toJson(QJsonDocument::Compact);
+    mq_reply reply = m_mqhttp->exec(_query, m_list, "POST", body);
+
+    //CouchDB 1.x has no _bulk_get, latest revisions can still be read in one request
+    if(reply.status == 404 || reply.status == 405)
+    {
+        QStringList ids;
+        bool pinned = false;
+        for(QJsonValue doc : docs)
+        {
+            ids << doc.toObject()["id"].toString();
+            pinned |= doc.toObject().contains("rev");
+        }
+
+        if(NOT pinned)
+            return allDocsKeys(database, ids);
+    }
 
     /*
      * Sample Json
-     * {"total_rows":6,"offset":0,"rows":
-     * [{"id":"76aa2bb58c4996a414d321e7a80021d3","key":"76aa2bb58c4996a414d321e7a80021d3","value":{"rev":"1-8ecb908fbedda2e535121a19db7194d6"}}]}
+     * {"results":[{"id":"a","docs":[{"ok":{"_id":"a","_rev":"1-8ecb908fbedda2e535121a19db7194d6","name":"test22"}}]},
+     *             {"id":"b","docs":[{"error":{"id":"b","rev":"undefined","error":"not_found","reason":"missing"}}]}]}
     */
 
-    QJsonObject entity = doc.object();
-    if(entity["result"] != "error")
+    if(reply.error == QNetworkReply::NoError)
     {
-        QJsonArray rows = entity["rows"].toArray();
-
-        for(QJsonValue row : rows)
+        for(QJsonValue result : QJsonDocument::fromJson(reply.body).object()["results"].toArray())
         {
-            QJsonObject _row = row.toObject();
-            _mq_document _doc = { .id = _row["id"].toString(), .rev = QJsonObject(_row["value"].toObject())["rev"].toString(), .ok = true };
+            QJsonObject _result = result.toObject();
+            QJsonObject entry = _result["docs"].toArray().at(0).toObject();
+
+            _mq_documentRaw _doc;
+            _doc.id = _result["id"].toString();
+
+            if(entry.contains("ok"))
+            {
+                QJsonObject document = entry["ok"].toObject();
+                _doc.rev = document["_rev"].toString();
+                _doc.data = QJsonDocument(document);
+            }
+            else
+            {
+                QJsonObject error = entry["error"].toObject();
+                _doc.error = error["error"].toString() + ": " + error["reason"].toString();
+            }
+
             data.push_back(_doc);
         }
 
@@ -277,179 +502,830 @@ QList<_mq_document> mqcouch::getDocumentList(QString database)
     }
 
     if(showDebug)
-        qDebug() << doc.object();
+        qDebug() << "Problem on bulk getting documents" << reply.errorString;
+
+    for(QJsonValue doc : docs)
+    {
+        _mq_documentRaw _doc;
+        _doc.id = doc.toObject()["id"].toString();
+        _doc.error = reply.errorString;
+        data.push_back(_doc);
+    }
 
     return data;
 }
 
-QList<_mq_document> mqcouch::getDocumentList(QString database, int limitValue, bool reversed)
+QList<_mq_documentRaw> mqcouch::allDocsKeys(QString database, QStringList ids)
 {
-    QString _query = databaseUrl + "/" + database + "/_all_docs" + "?limit=" + QString::number(limitValue) + "&descending=" + QString(reversed ? "true": "false");
-    QList<_mq_document> data;
-    QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
+    QString _query = nodeUrl(database) + "/" + database + "/_all_docs?include_docs=true";
+    QList<_mq_documentRaw> data;
+
+    const QByteArray body = QJsonDocument(QJsonObject{ {"keys", QJsonArray::fromStringList(ids)} }).toJson(QJsonDocument::Compact);
+    mq_reply reply = m_mqhttp->exec(_query, m_list, "POST", body);
 
     /*
      * Sample Json
-     * {"total_rows":6,"offset":0,"rows":
-     * [{"id":"76aa2bb58c4996a414d321e7a80021d3","key":"76aa2bb58c4996a414d321e7a80021d3","value":{"rev":"1-8ecb908fbedda2e535121a19db7194d6"}}]}
+     * {"total_rows":6,"rows":[{"id":"a","key":"a","value":{"rev":"1-8ecb908fbedda2e535121a19db7194d6"},"doc":{...}},
+     *                         {"key":"b","error":"not_found"}]}
     */
 
-    QJsonObject entity = doc.object();
-    if(entity["result"] != "error")
+    QJsonArray rows = QJsonDocument::fromJson(reply.body).object()["rows"].toArray();
+    for(int i = 0; i < ids.count(); i++)
     {
-        QJsonArray rows = entity["rows"].toArray();
-
-        for(QJsonValue row : rows)
+        QJsonObject _row = rows.at(i).toObject();
+
+        _mq_documentRaw _doc;
+        _doc.id = ids.at(i);
+
+        if(reply.error != QNetworkReply::NoError)
+            _doc.error = reply.errorString;
+        else if(_row.contains("error"))
+            _doc.error = _row["error"].toString();
+        else if(NOT _row["doc"].isObject())
+            _doc.error = "not_found: deleted";
+        else
         {
-            QJsonObject _row = row.toObject();
-            _mq_document _doc = { .id = _row["id"].toString(), .rev = QJsonObject(_row["value"].toObject())["rev"].toString(), .ok = true };
-            data.push_back(_doc);
+            _doc.rev = QJsonObject(_row["value"].toObject())["rev"].toString();
+            _doc.data = QJsonDocument(_row["doc"].toObject());
         }
 
-        return data;
+        data.push_back(_doc);
     }
 
-    if(showDebug)
-        qDebug() << doc.object();
-
     return data;
 }
 
-QList<QPair<int, QString>> mqcouch::getRevisionList(QString database, QString id, bool newFirstOrder)
+QList<_mq_document> mqcouch::getDocumentList(QString database)
 {
-     QString _query = databaseUrl + "/" + database + "/" + id + "?revs=true";
-     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
-
-     QList<QPair<int, QString>> list;
-
-     /*
-      *  QJsonObject({"_id":"76aa2bb58c4996a414d321e7a8002a21","_rev":"2-b85a6cbb064d3e0927b6bfe718321f5d",
-      * "_revisions":{"ids":["b85a6cbb064d3e0927b6bfe718321f5d","8ecb908fbedda2e535121a19db7194d6"],"start":2},
-      * "data":["sta","aka","dji"],"name":"a22test","result":null})
-      */
-
-     const QJsonObject entity = doc.object();
-     if(entity["result"] != "error")
-     {
-         QJsonArray ary = QJsonObject(entity["_revisions"].toObject())["ids"].toArray();
-
-         for(int i = 0; i < ary.count(); i++)
-         {
-             QPair<int, QString> val;
-             // For reverse order of the array
-             val.first = abs(ary.count() - i);
-             val.second = ary[i].toString();
+    QString _query = nodeUrl(database) + "/" + database + "/_all_docs";
+    QList<_mq_document> data;
+    QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
 
-             if(NOT newFirstOrder)
-                list.push_front(val);
-             else
-                 list.push_back(val);
-         }
+    /*
+     * Sample Json
+     * {"total_rows":6,"offset":0,"rows":
+     * [{"id":"76aa2bb58c4996a414d321e7a80021d3","key":"76aa2bb58c4996a414d321e7a80021d3","value":{"rev":"1-8ecb908fbedda2e535121a19db7194d6"}}]}
+    */
 
-         return list;
-     }
+    QJsonObject entity = doc.object();
+    if(entity["result"] != "error")
+        return mq_documentList(entity);
 
-     if(showDebug)
-         qCritical() << "Error message!!";
-         qDebug() << entity;
+    if(showDebug)
+        qDebug() << doc.object();
 
-     return QList<QPair<int, QString>>();
+    return data;
 }
 
-_mq_document mqcouch::addDocument(QString database, QJsonDocument body)
+QList<_mq_document> mqcouch::getDocumentList(QString database, int limitValue, bool reversed, QString startKey)
 {
-    QString _query = databaseUrl + "/" + database;
-    _mq_document response;
-    QJsonDocument doc = m_mqhttp->custom(_query, m_list, "POST", body.toJson(), JSON).toJsonDocument();
+    QString _query = nodeUrl(database) + "/" + database + "/_all_docs" + "?limit=" + QString::number(limitValue) + "&descending=" + QString(reversed ? "true": "false");
+    if(NOT startKey.isEmpty())
+        _query += "&startkey=" + encodeKey(startKey);
+    QList<_mq_document> data;
+    QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
 
     /*
      * Sample Json
-     * {"id":"76aa2bb58c4996a414d321e7a8001211","ok":true,"result":null,"rev":"1-49ce25e3db701c8cb613c1fd18d99619"}
+     * {"total_rows":6,"offset":0,"rows":
+     * [{"id":"76aa2bb58c4996a414d321e7a80021d3","key":"76aa2bb58c4996a414d321e7a80021d3","value":{"rev":"1-8ecb908fbedda2e535121a19db7194d6"}}]}
     */
 
     QJsonObject entity = doc.object();
     if(entity["result"] != "error")
-    {
-        response.id = entity["id"].toString();
-        response.rev = entity["rev"].toString();
-        response.ok = entity["ok"].toBool();
+        return mq_documentList(entity);
 
-        return response;
-    }
+    if(showDebug)
+        qDebug() << doc.object();
 
-    return response;
+    return data;
 }
 
-_mq_document mqcouch::updateDocument(QString database, QJsonDocument body, QString id)
+bool mqcouch::streamDocumentList(QString database, mq_listCallback callback)
 {
-    QString rev = getDocument(database, id).rev;
-    QString _query = databaseUrl + "/" + database + "/" + id + "?rev=" + rev;
-
-    _mq_document response;
+    QString _query = nodeUrl(database) + "/" + database + "/_all_docs";
 
-    QJsonDocument doc = m_mqhttp->custom(_query, m_list, "PUT", body.toJson(), JSON).toJsonDocument();
-
-    QJsonObject entity = doc.object();
-    if(entity["result"] != "error")
+    return streamRows(_query, "GET", QByteArray(), "rows", [callback](const QJsonObject &_row)
     {
-        response.id = entity["id"].toString();
-        response.rev = entity["rev"].toString();
-        response.ok = entity["ok"].toBool();
+        callback(mq_rowDocument(_row));
+    });
+}
 
-        return response;
-    }
+_mq_findResult mqcouch::find(QString database, _mq_findOptions options, mq_findCallback callback)
+{
+    QString _query = nodeUrl(database) + "/" + database + "/_find";
+
+    QJsonObject request{ {"selector", options.selector} };
+    if(NOT options.fields.isEmpty())
+        request["fields"] = QJsonArray::fromStringList(options.fields);
+    if(NOT options.sort.isEmpty())
+        request["sort"] = options.sort;
+    if(options.limit >= 0)
+        request["limit"] = options.limit;
+    if(options.skip > 0)
+        request["skip"] = options.skip;
+    if(NOT options.bookmark.isEmpty())
+        request["bookmark"] = options.bookmark;
+    if(NOT options.useIndex.isEmpty())
+        request["use_index"] = options.useIndex;
+    if(options.executionStats)
+        request["execution_stats"] = true;
 
-    if(showDebug)
-        qDebug() << doc.object();
+    /*
+     * Sample Json
+     * {"docs":[{"_id":"76aa2bb58c4996a414d321e7a80021d3","name":"test22"}],
+     *  "bookmark":"g1AAAABweJzLYWBgYMpgSmHgKy5JLCrJTq2MT8lPzkzJBYqbm5slGpsZmVkAAFNmCAk",
+     *  "warning":"No matching index found, create an index to optimize query time."}
+    */
 
-    return response;
-}
+    _mq_findResult result;
+    QJsonObject envelope;
+    mq_reply reply;
 
-_mq_document mqcouch::updateDocument(QString database, QJsonDocument body, _mq_document fdoc)
-{
-    QString _query = databaseUrl + "/" + database + "/" + fdoc.id + "?rev=" + fdoc.rev;
+    result.ok = streamRows(_query, "POST", QJsonDocument(request).toJson(QJsonDocument::Compact), "docs", callback, &envelope, &reply);
 
-    _mq_document response;
+    if(reply.error != QNetworkReply::NoError)
+    {
+        QJsonObject entity = QJsonDocument::fromJson(reply.body).object();
+        result.error = entity["error"].toString() + ": " + entity["reason"].toString();
+        return result;
+    }
 
-    QJsonDocument doc = m_mqhttp->custom(_query, m_list, "PUT", body.toJson(), JSON).toJsonDocument();
+    result.bookmark = envelope["bookmark"].toString();
+    result.warning = envelope["warning"].toString();
+    result.executionStats = envelope["execution_stats"].toObject();
 
-    QJsonObject entity = doc.object();
-    if(entity["result"] != "error")
+    if(NOT result.warning.isEmpty())
     {
-        response.id = entity["id"].toString();
-        response.rev = entity["rev"].toString();
-        response.ok = entity["ok"].toBool();
+        if(showDebug)
+            qWarning() << "_find on" << database << result.warning << options.selector;
 
-        return response;
+        emit findWarning(database, result.warning);
     }
 
-    if(showDebug)
-        qDebug() << doc.object();
+    return result;
+}
 
-    return response;
+_mq_findResult mqcouch::find(QString database, _mq_findOptions options)
+{
+    QList<QJsonObject> docs;
+
+    _mq_findResult result = find(database, options, [&docs](const QJsonObject &doc) { docs.push_back(doc); });
+    if(result.ok)
+        result.docs = docs;
+
+    return result;
 }
 
-bool mqcouch::removeDocument(QString database, QString id)
+bool mqcouch::createIndex(QString database, QJsonArray fields, QString name, QString ddoc, QJsonObject partialFilter)
 {
-    QString rev = getDocument(database, id).rev;
-    QString _query = databaseUrl + "/" + database + "/" + id + "?rev=" + rev;
+    QString _query = nodeUrl(database, true) + "/" + database + "/_index";
 
-    QJsonDocument doc = m_mqhttp->custom(_query, m_list, "DELETE", JSON).toJsonDocument();
+    QJsonObject index{ {"fields", fields} };
+    if(NOT partialFilter.isEmpty())
+        index["partial_filter_selector"] = partialFilter;
+
+    QJsonObject request{ {"index", index}, {"type", "json"} };
+    if(NOT name.isEmpty())
+        request["name"] = name;
+    if(NOT ddoc.isEmpty())
+        request["ddoc"] = ddoc;
+
+    mq_reply reply = m_mqhttp->exec(_query, m_list, "POST", QJsonDocument(request).toJson(QJsonDocument::Compact));
 
     /*
      * Sample Json
-     * {"id":"76aa2bb58c4996a414d321e7a8001211","ok":true,"rev":"2-277a0d434467120336c479306bd814aa"}
+     * {"result":"created","id":"_design/by-year","name":"year-index"}
     */
 
-    QJsonObject entity = doc.object();
-    if(entity["result"] != "error")
+    if(reply.error != QNetworkReply::NoError)
     {
-        /*
         if(showDebug)
-            qDebug() << doc.object();
-        */
+            qDebug() << "Problem on creating index" << reply.errorString << reply.body;
 
-        return true;
+        return false;
+    }
+
+    return true;
+}
+
+QList<_mq_index> mqcouch::getIndexes(QString database)
+{
+    QString _query = nodeUrl(database) + "/" + database + "/_index";
+    QList<_mq_index> data;
+
+    mq_reply reply = m_mqhttp->exec(_query, m_list, "GET");
+
+    /*
+     * Sample Json
+     * {"total_rows":2,"indexes":[{"ddoc":null,"name":"_all_docs","type":"special","def":{"fields":[{"_id":"asc"}]}},
+     *  {"ddoc":"_design/by-year","name":"year-index","type":"json","def":{"fields":[{"year":"asc"}]}}]}
+    */
+
+    if(reply.error != QNetworkReply::NoError)
+    {
+        if(showDebug)
+            qDebug() << "Problem on listing indexes" << reply.errorString << reply.body;
+
+        return data;
+    }
+
+    QJsonArray indexes = QJsonDocument::fromJson(reply.body).object()["indexes"].toArray();
+    for(QJsonValue index : indexes)
+    {
+        QJsonObject _index = index.toObject();
+        data.push_back(_mq_index{ .ddoc = _index["ddoc"].toString(), .name = _index["name"].toString(),
+                                  .type = _index["type"].toString(), .definition = _index["def"].toObject() });
+    }
+
+    return data;
+}
+
+bool mqcouch::removeIndex(QString database, QString ddoc, QString name, QString type)
+{
+    if(ddoc.startsWith("_design/"))
+        ddoc = ddoc.mid(8);
+
+    QString _query = nodeUrl(database, true) + "/" + database + "/_index/" + QUrl::toPercentEncoding(ddoc) + "/"
+            + QUrl::toPercentEncoding(type) + "/" + QUrl::toPercentEncoding(name);
+
+    mq_reply reply = m_mqhttp->exec(_query, m_list, "DELETE");
+
+    if(reply.error != QNetworkReply::NoError)
+    {
+        if(showDebug)
+            qDebug() << "Problem on removing index" << reply.errorString << reply.body;
+
+        return false;
+    }
+
+    return true;
+}
+
+mqchanges *mqcouch::subscribeChanges(QString database, _mq_changesOptions options)
+{
+    mqchanges *subscriber = new mqchanges(m_mqhttp, databaseUrl, database, options, showDebug, this);
+    //Reconnects of the feed go to a healthy node
+    if(m_cluster && NOT m_cluster->nodes().isEmpty())
+        subscriber->setCluster(m_cluster);
+
+    //Started from the event loop so signals can be connected first
+    QTimer::singleShot(0, subscriber, &mqchanges::start);
+
+    return subscriber;
+}
+
+bool mqcouch::streamRows(QString query, QString verb, QByteArray body, QByteArray arrayKey, mq_rowCallback callback,
+                         QJsonObject *envelope, mq_reply *reply)
+{
+    mqrowparser parser(arrayKey, callback);
+    QEventLoop q_eventLoop;
+    mq_reply result;
+
+    m_mqhttp->stream(query, m_list, verb, body, [&parser](const QByteArray &chunk, int)
+    {
+        parser.feed(chunk);
+    }, [&](const mq_reply &reply)
+    {
+        result = reply;
+        q_eventLoop.quit();
+    });
+
+    q_eventLoop.exec();
+
+    if(reply)
+        *reply = result;
+
+    if(result.error != QNetworkReply::NoError)
+    {
+        if(showDebug)
+            qDebug() << "Problem on streaming rows" << result.errorString << result.body;
+
+        return false;
+    }
+
+    if(envelope)
+        *envelope = parser.envelope();
+
+    return parser.isComplete();
+}
+
+QList<_mq_document> mqcouch::documentPage(QString database, const _mq_cursorOptions &options, QString startKey, QString *nextKey,
+                                          QString *errorString)
+{
+    const int pageSize = qMax(1, options.pageSize);
+
+    //One extra row tells where the next page starts
+    QString _query = nodeUrl(database) + "/" + database + "/_all_docs" + "?limit=" + QString::number(pageSize + 1)
+            + "&descending=" + QString(options.descending ? "true" : "false")
+            + "&inclusive_end=" + QString(options.inclusiveEnd ? "true" : "false");
+
+    if(NOT startKey.isEmpty())
+        _query += "&startkey=" + encodeKey(startKey) + "&startkey_docid=" + QUrl::toPercentEncoding(startKey);
+    if(NOT options.endKey.isEmpty())
+        _query += "&endkey=" + encodeKey(options.endKey);
+
+    QList<_mq_document> data;
+    *nextKey = QString();
+    *errorString = QString();
+
+    mq_reply reply = m_mqhttp->exec(_query, m_list, "GET");
+    QJsonDocument doc = QJsonDocument::fromJson(reply.body);
+
+    QJsonObject entity = doc.object();
+    if(reply.error == QNetworkReply::NoError && reply.status == 200 && entity.contains("rows"))
+    {
+        QJsonArray rows = entity["rows"].toArray();
+
+        for(QJsonValue row : rows)
+        {
+            QJsonObject _row = row.toObject();
+
+            if(data.count() == pageSize)
+            {
+                *nextKey = _row["id"].toString();
+                break;
+            }
+
+            data.push_back(mq_rowDocument(_row));
+        }
+
+        return data;
+    }
+
+    //A failed page must not look like the end of the range
+    if(entity.contains("reason"))
+        *errorString = entity["error"].toString() + ": " + entity["reason"].toString();
+    else if(NOT reply.errorString.isEmpty())
+        *errorString = reply.errorString;
+    else
+        *errorString = "Unexpected _all_docs response, status " + QString::number(reply.status);
+
+    if(showDebug)
+        qDebug() << "Problem on reading document page" << *errorString;
+
+    return data;
+}
+
+QByteArray mqcouch::encodeKey(const QString &key)
+{
+    return encodeKey(QJsonValue(key));
+}
+
+QByteArray mqcouch::encodeKey(const QJsonValue &key)
+{
+    //Keys are JSON values, [key] without brackets gives the encoded value
+    const QByteArray array = QJsonDocument(QJsonArray{ key }).toJson(QJsonDocument::Compact);
+    return QUrl::toPercentEncoding(QString::fromUtf8(array.mid(1, array.size() - 2)));
+}
+
+bool mqcouch::queryView(QString database, QString design, QString view, _mq_viewOptions options, mq_viewCallback callback,
+                        QJsonObject *envelope)
+{
+    QString _query = nodeUrl(database) + "/" + database + "/_design/" + QUrl::toPercentEncoding(design)
+            + "/_view/" + QUrl::toPercentEncoding(view) + "?inclusive_end=" + QString(options.inclusiveEnd ? "true" : "false");
+
+    if(NOT options.key.isUndefined())
+        _query += "&key=" + encodeKey(options.key);
+    if(NOT options.startKey.isUndefined())
+        _query += "&startkey=" + encodeKey(options.startKey);
+    if(NOT options.startKeyDocId.isEmpty())
+        _query += "&startkey_docid=" + QUrl::toPercentEncoding(options.startKeyDocId);
+    if(NOT options.endKey.isUndefined())
+        _query += "&endkey=" + encodeKey(options.endKey);
+    if(NOT options.endKeyDocId.isEmpty())
+        _query += "&endkey_docid=" + QUrl::toPercentEncoding(options.endKeyDocId);
+    if(options.limit >= 0)
+        _query += "&limit=" + QString::number(options.limit);
+    if(options.skip > 0)
+        _query += "&skip=" + QString::number(options.skip);
+    if(options.descending)
+        _query += "&descending=true";
+    if(options.includeDocs)
+        _query += "&include_docs=true";
+
+    //reduce=true fails on views without a reduce function, only the override is sent
+    if(NOT options.reduce)
+        _query += "&reduce=false";
+    if(options.group)
+        _query += "&group=true";
+    if(options.groupLevel >= 0)
+        _query += "&group_level=" + QString::number(options.groupLevel);
+
+    if(options.update == VIEW_UPDATE_FALSE)
+        _query += "&update=false";
+    else if(options.update == VIEW_UPDATE_LAZY)
+        _query += "&update=lazy";
+    if(options.stable)
+        _query += "&stable=true";
+
+    QString verb = "GET";
+    QByteArray body;
+    if(NOT options.keys.isEmpty())
+    {
+        verb = "POST";
+        body = QJsonDocument(QJsonObject{ {"keys", options.keys} }).toJson(QJsonDocument::Compact);
+    }
+
+    /*
+     * Sample Json
+     * {"total_rows":3,"offset":0,"rows":[{"id":"76aa2bb58c4996a414d321e7a80021d3","key":"test22","value":null}]}
+     * {"rows":[{"key":null,"value":3}]}
+    */
+
+    return streamRows(_query, verb, body, "rows", [callback](const QJsonObject &_row)
+    {
+        _mq_viewRow row;
+        row.id = _row["id"].toString();
+        row.key = _row["key"];
+        row.value = _row["value"];
+        row.doc = _row["doc"].toObject();
+        row.error = _row["error"].toString();
+
+        callback(row);
+    }, envelope);
+}
+
+QList<_mq_viewRow> mqcouch::queryView(QString database, QString design, QString view, _mq_viewOptions options)
+{
+    QList<_mq_viewRow> data;
+
+    if(NOT queryView(database, design, view, options, [&data](const _mq_viewRow &row) { data.push_back(row); }))
+        data.clear();
+
+    return data;
+}
+
+QList<QPair<int, QString>> mqcouch::getRevisionList(QString database, QString id, bool newFirstOrder)
+{
+     QString _query = mq_documentUrl(nodeUrl(database), database, id, "revs=true");
+     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
+
+     QList<QPair<int, QString>> list;
+
+     /*
+      *  QJsonObject({"_id":"76aa2bb58c4996a414d321e7a8002a21","_rev":"2-b85a6cbb064d3e0927b6bfe718321f5d",
+      * "_revisions":{"ids":["b85a6cbb064d3e0927b6bfe718321f5d","8ecb908fbedda2e535121a19db7194d6"],"start":2},
+      * "data":["sta","aka","dji"],"name":"a22test","result":null})
+      */
+
+     const QJsonObject entity = doc.object();
+     if(entity["result"] != "error")
+     {
+         QJsonArray ary = QJsonObject(entity["_revisions"].toObject())["ids"].toArray();
+
+         for(int i = 0; i < ary.count(); i++)
+         {
+             QPair<int, QString> val;
+             // For reverse order of the array
+             val.first = abs(ary.count() - i);
+             val.second = ary[i].toString();
+
+             if(NOT newFirstOrder)
+                list.push_front(val);
+             else
+                 list.push_back(val);
+         }
+
+         return list;
+     }
+
+     if(showDebug)
+         qCritical() << "Error message!!";
+         qDebug() << entity;
+
+     return QList<QPair<int, QString>>();
+}
+
+_mq_document mqcouch::addDocument(QString database, QJsonDocument body)
+{
+    return addDocument(database, body.toJson(QJsonDocument::Compact));
+}
+
+_mq_document mqcouch::addDocument(QString database, QByteArray body)
+{
+    QString _query = nodeUrl(database, true) + "/" + database;
+    _mq_document response;
+    QJsonDocument doc = m_mqhttp->custom(_query, m_list, "POST", body, JSON).toJsonDocument();
+
+    /*
+     * Sample Json
+     * {"id":"76aa2bb58c4996a414d321e7a8001211","ok":true,"result":null,"rev":"1-49ce25e3db701c8cb613c1fd18d99619"}
+    */
+
+    QJsonObject entity = doc.object();
+    if(entity["result"] != "error")
+    {
+        response.id = entity["id"].toString();
+        response.rev = entity["rev"].toString();
+        response.ok = entity["ok"].toBool();
+
+        return response;
+    }
+
+    return response;
+}
+
+void mqcouch::addDocument(QString database, QJsonDocument body, mq_writeCallback callback, requestPriority priority)
+{
+    addDocument(database, body.toJson(QJsonDocument::Compact), callback, priority);
+}
+
+void mqcouch::addDocument(QString database, QByteArray body, mq_writeCallback callback, requestPriority priority)
+{
+    QString _query = nodeUrl(database, true) + "/" + database;
+
+    m_mqhttp->request(_query, m_list, "POST", body, [this, callback](const mq_reply &reply)
+    {
+        _mq_document response = { .id = QString(), .rev = QString(), .ok = false };
+
+        if(reply.error == QNetworkReply::NoError)
+        {
+            QJsonObject entity = QJsonDocument::fromJson(reply.body).object();
+            response.id = entity["id"].toString();
+            response.rev = entity["rev"].toString();
+            response.ok = entity["ok"].toBool();
+        }
+        else if(showDebug)
+            qDebug() << "Problem on adding document" << reply.errorString;
+
+        if(callback)
+            callback(response);
+    }, priority);
+}
+
+QList<_mq_document> mqcouch::addDocuments(QString database, QList<QJsonDocument> documents)
+{
+    QList<QByteArray> encoded;
+    for(const QJsonDocument &document : documents)
+        encoded << document.toJson(QJsonDocument::Compact);
+
+    return addDocuments(database, encoded);
+}
+
+QList<_mq_document> mqcouch::addDocuments(QString database, QList<QByteArray> documents)
+{
+    QString _query = nodeUrl(database, true) + "/" + database + "/_bulk_docs";
+
+    QByteArray joined;
+    for(const QByteArray &document : documents)
+    {
+        if(NOT joined.isEmpty())
+            joined += ',';
+        joined += document;
+    }
+
+    mq_reply reply = m_mqhttp->exec(_query, m_list, "POST", bulkPayload(joined));
+
+    if(showDebug && reply.error != QNetworkReply::NoError)
+        qDebug() << "Problem on bulk writing" << reply.errorString;
+
+    QList<_mq_document> results = bulkResults(reply, documents.count());
+    for(const _mq_document &result : results)
+        invalidateCached(database, result.id);
+
+    return results;
+}
+
+void mqcouch::setBulkBuffering(QString database, int maxDocuments, int lingerMs)
+{
+    if(maxDocuments <= 0)
+    {
+        if(m_bulkBuffers.contains(database))
+        {
+            flush(database);
+            delete m_bulkBuffers.take(database).timer;
+        }
+        return;
+    }
+
+    _mq_bulkBuffer &buffer = m_bulkBuffers[database];
+    if(NOT buffer.timer)
+    {
+        buffer.count = 0;
+        buffer.timer = new QTimer(this);
+        buffer.timer->setSingleShot(true);
+        connect(buffer.timer, &QTimer::timeout, this, [this, database]() { flushLater(database); });
+    }
+
+    buffer.maxDocuments = maxDocuments;
+    buffer.lingerMs = lingerMs;
+}
+
+bool mqcouch::isBulkBuffered(QString database) const
+{
+    return m_bulkBuffers.contains(database);
+}
+
+void mqcouch::bufferDocument(QString database, QJsonDocument body)
+{
+    bufferDocument(database, body.toJson(QJsonDocument::Compact));
+}
+
+void mqcouch::bufferDocument(QString database, QByteArray body)
+{
+    if(NOT m_bulkBuffers.contains(database))
+    {
+        addDocument(database, body);
+        return;
+    }
+
+    _mq_bulkBuffer &buffer = m_bulkBuffers[database];
+
+    if(buffer.count > 0)
+        buffer.payload += ',';
+    buffer.payload += body;
+    buffer.count++;
+
+    if(buffer.count >= buffer.maxDocuments)
+        flush(database);
+    else if(buffer.count == 1 && buffer.lingerMs > 0)
+        buffer.timer->start(buffer.lingerMs);
+}
+
+QList<_mq_document> mqcouch::flush(QString database)
+{
+    if(NOT m_bulkBuffers.contains(database) || m_bulkBuffers[database].count == 0)
+        return QList<_mq_document>();
+
+    _mq_bulkBuffer &buffer = m_bulkBuffers[database];
+    const QByteArray payload = bulkPayload(buffer.payload);
+    const int count = buffer.count;
+
+    buffer.timer->stop();
+    buffer.payload.clear();
+    buffer.count = 0;
+
+    QString _query = nodeUrl(database, true) + "/" + database + "/_bulk_docs";
+    mq_reply reply = m_mqhttp->exec(_query, m_list, "POST", payload);
+
+    if(showDebug && reply.error != QNetworkReply::NoError)
+        qDebug() << "Problem on flushing bulk buffer" << reply.errorString;
+
+    QList<_mq_document> results = bulkResults(reply, count);
+    for(const _mq_document &result : results)
+        invalidateCached(database, result.id);
+
+    emit bulkFlushed(database, results);
+
+    return results;
+}
+
+void mqcouch::flushLater(QString database)
+{
+    if(NOT m_bulkBuffers.contains(database) || m_bulkBuffers[database].count == 0)
+        return;
+
+    _mq_bulkBuffer &buffer = m_bulkBuffers[database];
+    const QByteArray payload = bulkPayload(buffer.payload);
+    const int count = buffer.count;
+
+    buffer.payload.clear();
+    buffer.count = 0;
+
+    //Linger flushes don't block the event loop, results are only emitted
+    QString _query = nodeUrl(database, true) + "/" + database + "/_bulk_docs";
+    m_mqhttp->request(_query, m_list, "POST", payload, [this, database, count](const mq_reply &reply)
+    {
+        if(showDebug && reply.error != QNetworkReply::NoError)
+            qDebug() << "Problem on flushing bulk buffer" << reply.errorString;
+
+        QList<_mq_document> results = bulkResults(reply, count);
+        for(const _mq_document &result : results)
+            invalidateCached(database, result.id);
+
+        emit bulkFlushed(database, results);
+    });
+}
+
+QByteArray mqcouch::bulkPayload(const QByteArray &joinedDocuments)
+{
+    return "{\"docs\":[" + joinedDocuments + "]}";
+}
+
+QList<_mq_document> mqcouch::bulkResults(const mq_reply &reply, int count)
+{
+    QList<_mq_document> results;
+
+    /*
+     * Sample Json
+     * [{"ok":true,"id":"76aa2bb58c4996a414d321e7a8001211","rev":"1-49ce25e3db701c8cb613c1fd18d99619"},
+     *  {"id":"a","error":"conflict","reason":"Document update conflict."}]
+    */
+
+    if(reply.error == QNetworkReply::NoError)
+    {
+        for(QJsonValue row : QJsonDocument::fromJson(reply.body).array())
+        {
+            QJsonObject _row = row.toObject();
+            _mq_document _doc = { .id = _row["id"].toString(), .rev = _row["rev"].toString(), .ok = _row["ok"].toBool() };
+            results.push_back(_doc);
+        }
+    }
+
+    //Whole request failed, every buffered row is reported as failed
+    while(results.count() < count)
+        results.push_back(_mq_document{ .id = QString(), .rev = QString(), .ok = false });
+
+    return results;
+}
+
+_mq_document mqcouch::updateDocument(QString database, QJsonDocument body, QString id)
+{
+    return updateDocument(database, body.toJson(QJsonDocument::Compact), id);
+}
+
+_mq_document mqcouch::updateDocument(QString database, QByteArray data, QString id)
+{
+    _mq_document response = { .id = QString(), .rev = QString(), .ok = false };
+
+    for(int attempt = 0; attempt <= m_conflictRetries; attempt++)
+    {
+        QString rev = getRevision(database, id);
+        QString _query = mq_documentUrl(nodeUrl(database, true), database, id, "rev=" + rev);
+
+        mq_reply reply = m_mqhttp->exec(_query, m_list, "PUT", data);
+        invalidateCached(database, id);
+
+        //Someone else wrote in between, try again on the new revision
+        if(reply.status == 409 && attempt < m_conflictRetries)
+        {
+            recordRetry("updateDocument", database);
+            continue;
+        }
+
+        QJsonObject entity = QJsonDocument::fromJson(reply.body).object();
+        if(reply.error == QNetworkReply::NoError)
+        {
+            response.id = entity["id"].toString();
+            response.rev = entity["rev"].toString();
+            response.ok = entity["ok"].toBool();
+
+            return response;
+        }
+
+        if(showDebug)
+            qDebug() << reply.errorString << entity;
+
+        break;
+    }
+
+    return response;
+}
+
+_mq_document mqcouch::updateDocument(QString database, QJsonDocument body, _mq_document fdoc)
+{
+    return updateDocument(database, body.toJson(QJsonDocument::Compact), fdoc);
+}
+
+_mq_document mqcouch::updateDocument(QString database, QByteArray body, _mq_document fdoc)
+{
+    QString _query = nodeUrl(database, true) + "/" + database + "/" + fdoc.id + "?rev=" + fdoc.rev;
+
+    _mq_document response;
+
+    QJsonDocument doc = m_mqhttp->custom(_query, m_list, "PUT", body, JSON).toJsonDocument();
+    invalidateCached(database, fdoc.id);
+
+    QJsonObject entity = doc.object();
+    if(entity["result"] != "error")
+    {
+        response.id = entity["id"].toString();
+        response.rev = entity["rev"].toString();
+        response.ok = entity["ok"].toBool();
+
+        return response;
+    }
+
+    if(showDebug)
+        qDebug() << doc.object();
+
+    return response;
+}
+
+bool mqcouch::removeDocument(QString database, QString id)
+{
+    for(int attempt = 0; attempt <= m_conflictRetries; attempt++)
+    {
+        QString rev = getRevision(database, id);
+        QString _query = mq_documentUrl(nodeUrl(database, true), database, id, "rev=" + rev);
+
+        mq_reply reply = m_mqhttp->exec(_query, m_list, "DELETE");
+        invalidateCached(database, id);
+
+        /*
+         * Sample Json
+         * {"id":"76aa2bb58c4996a414d321e7a8001211","ok":true,"rev":"2-277a0d434467120336c479306bd814aa"}
+        */
+
+        if(reply.error == QNetworkReply::NoError)
+            return true;
+
+        if(reply.status != 409)
+            break;
+
+        if(attempt < m_conflictRetries)
+            recordRetry("removeDocument", database);
     }
 
     return false;
@@ -457,9 +1333,10 @@ bool mqcouch::removeDocument(QString database, QString id)
 
 bool mqcouch::removeDocument(QString database, _mq_document document)
 {
-    QString _query = databaseUrl + "/" + database + "/" + document.id + "?rev=" + document.rev;
+    QString _query = nodeUrl(database, true) + "/" + database + "/" + document.id + "?rev=" + document.rev;
 
     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "DELETE", JSON).toJsonDocument();
+    invalidateCached(database, document.id);
 
     /*
      * Sample Json
@@ -503,13 +1380,13 @@ QStringList mqcouch::getAttachmentList(QString database, QString id)
 bool mqcouch::addAttachmentToDocument(QString database, _mq_document fdoc, QString fileurl)
 {
     //Append attachment to last revision
-    fdoc.rev = getDocument(database, fdoc.id).rev;
+    fdoc.rev = getRevision(database, fdoc.id);
 
-    //File object
-    QFile *file = new QFile(fileurl);
-    file->open(QIODevice::ReadOnly);
+    //File object, streamed from disk while uploading
+    QFile file(fileurl);
+    file.open(QIODevice::ReadOnly);
 
-    if(NOT file->isOpen())
+    if(NOT file.isOpen())
     {
         if(showDebug)
             qDebug() << "File is not readable!";
@@ -517,30 +1394,70 @@ bool mqcouch::addAttachmentToDocument(QString database, _mq_document fdoc, QStri
         return false;
     }
 
-    QFileInfo info(*file);
+    QFileInfo info(file);
 
     const QString mimetype = mimedb.mimeTypeForFile(info, QMimeDatabase::MatchContent).name();
-    const QByteArray imported = file->readAll();
 
-    file->close();
+    return addAttachmentToDocumentStream(database, fdoc, info.fileName(), mimetype, &file, file.size());
+}
 
-    _mq_attachment finalFile = {
-        .name = info.fileName(),
-        .mimeType = mimetype,
-        .body = imported
-    };
+bool mqcouch::addAttachmentToDocumentStream(QString database, _mq_document fdoc, QString name, QString mimeType, QIODevice *device, qint64 size)
+{
+    QString _query = nodeUrl(database, true) + "/" + database + "/" + fdoc.id + "/" + name + "?rev=" + fdoc.rev;
 
-    return addAttachmentToDocumentRaw(database, fdoc, finalFile);
+    QList<mq_httpHeader> customList;
+    customList << mq_httpHeader{ .key = "Content-Type", .value = mimeType };
+
+    QEventLoop q_eventLoop;
+    mq_reply result;
+
+    m_uploadTicket = m_mqhttp->upload(_query, customList, "PUT", device, size, [&](const mq_reply &reply)
+    {
+        result = reply;
+        q_eventLoop.quit();
+    });
+
+    const quint64 ticket = m_uploadTicket;
+    QMetaObject::Connection progress = connect(m_mqhttp, &mqhttp::uploadProgress, this, [this, ticket](quint64 t, qint64 bytesSent, qint64 bytesTotal)
+    {
+        if(t == ticket)
+            emit attachmentUploadProgress(bytesSent, bytesTotal);
+    });
+
+    q_eventLoop.exec();
+
+    disconnect(progress);
+    m_uploadTicket = 0;
+    invalidateCached(database, fdoc.id);
+
+    /*
+     * Sample Json
+     * {"ok":true,"id":"doc","rev":"1-287a28fa680ae0c7fb4729bf0c6e0cf2"}
+    */
+    if(result.error == QNetworkReply::NoError)
+        return true;
+
+    if(showDebug)
+        qDebug() << "Some problem on uploading!" << result.errorString << result.body;
+
+    return false;
+}
+
+void mqcouch::cancelAttachmentUpload()
+{
+    if(m_uploadTicket)
+        m_mqhttp->abort(m_uploadTicket);
 }
 
 bool mqcouch::addAttachmentToDocumentRaw(QString database, _mq_document fdoc, _mq_attachment attachment)
 {
-    QString _query = databaseUrl + "/" + database + "/" + fdoc.id + "/" + attachment.name + "?rev=" + fdoc.rev;
+    QString _query = nodeUrl(database, true) + "/" + database + "/" + fdoc.id + "/" + attachment.name + "?rev=" + fdoc.rev;
 
     QList<mq_httpHeader> customList;
     customList << mq_httpHeader{ .key = "Content-Type", .value = attachment.mimeType };
 
     QJsonDocument m_doc = m_mqhttp->custom(_query, customList, "PUT", attachment.body, JSON).toJsonDocument();
+    invalidateCached(database, fdoc.id);
     QJsonObject entity = m_doc.object();
 
     /*
@@ -558,11 +1475,179 @@ bool mqcouch::addAttachmentToDocumentRaw(QString database, _mq_document fdoc, _m
     return false;
 }
 
+_mq_attachmentDownload mqcouch::getAttachment(QString database, QString id, QString name, QIODevice *sink, qint64 offset, qint64 length)
+{
+    QString _query = nodeUrl(database) + "/" + database + "/" + id + "/" + name;
+
+    _mq_attachmentDownload download = { .ok = false, .status = 0, .bytes = 0, .totalSize = -1,
+                                        .digest = QString(), .verified = false, .mimeType = QString() };
+
+    const bool ranged = offset > 0 || length >= 0;
+
+    QList<mq_httpHeader> headers;
+    if(ranged)
+        headers << mq_httpHeader{ .key = "Range", .value = "bytes=" + QString::number(offset) + "-" + (length >= 0 ? QString::number(offset + length - 1) : QString()) };
+
+    QCryptographicHash md5(QCryptographicHash::Md5);
+    qint64 skip = -1;
+    qint64 remaining = length;
+    bool writeFailed = false;
+
+    QEventLoop q_eventLoop;
+    mq_reply result;
+
+    m_mqhttp->stream(_query, headers, "GET", QByteArray(), [&](const QByteArray &chunk, int status)
+    {
+        //Server ignored Range (ex. compressed attachments) and sends the whole body
+        if(skip < 0)
+            skip = (ranged && status == 200) ? offset : 0;
+
+        QByteArray data = chunk;
+        if(skip > 0)
+        {
+            const qint64 dropped = qMin<qint64>(skip, data.size());
+            data.remove(0, dropped);
+            skip -= dropped;
+        }
+        if(remaining >= 0)
+        {
+            data.truncate(qMin<qint64>(remaining, data.size()));
+            remaining -= data.size();
+        }
+
+        if(data.isEmpty() || writeFailed)
+            return;
+
+        if(NOT ranged)
+            md5.addData(data);
+
+        if(sink->write(data) != data.size())
+            writeFailed = true;
+
+        download.bytes += data.size();
+    }, [&](const mq_reply &reply)
+    {
+        result = reply;
+        q_eventLoop.quit();
+    });
+
+    q_eventLoop.exec();
+
+    download.status = result.status;
+    download.digest = attachmentDigest(result);
+    download.mimeType = QString::fromLatin1(mq_replyHeader(result, "Content-Type"));
+
+    //Content-Range: bytes 0-1023/146515
+    const QByteArray range = mq_replyHeader(result, "Content-Range");
+    if(range.contains('/'))
+        download.totalSize = range.mid(range.indexOf('/') + 1).toLongLong();
+    else if(result.status == 200)
+        download.totalSize = mq_replyHeader(result, "Content-Length").isEmpty() ? download.bytes : mq_replyHeader(result, "Content-Length").toLongLong();
+
+    const QByteArray contentMd5 = mq_replyHeader(result, "Content-MD5");
+    if(NOT ranged && NOT contentMd5.isEmpty())
+        download.verified = md5.result().toBase64() == contentMd5;
+
+    download.ok = result.error == QNetworkReply::NoError && NOT writeFailed;
+
+    if(NOT download.ok && showDebug)
+        qDebug() << "Some problem on downloading!" << result.errorString << result.body;
+
+    return download;
+}
+
+_mq_attachmentDownload mqcouch::getAttachmentSegmented(QString database, QString id, QString name, QFileDevice *sink, int segments)
+{
+    QString _query = nodeUrl(database) + "/" + database + "/" + id + "/" + name;
+
+    //Length and range support of the attachment, body is not downloaded
+    mq_reply head = m_mqhttp->exec(_query, QList<mq_httpHeader>(), "HEAD");
+
+    const qint64 total = mq_replyHeader(head, "Content-Length").toLongLong();
+    const bool ranges = mq_replyHeader(head, "Accept-Ranges") == "bytes";
+
+    if(head.error != QNetworkReply::NoError || segments <= 1 || NOT ranges || total <= 0 || NOT sink->resize(total))
+        return getAttachment(database, id, name, sink);
+
+    const qint64 segmentSize = (total + segments - 1) / segments;
+    QVector<qint64> positions;
+    int running = 0;
+    bool failed = false;
+    qint64 written = 0;
+
+    QEventLoop q_eventLoop;
+
+    for(int i = 0; i < segments && i * segmentSize < total; i++)
+    {
+        const qint64 start = i * segmentSize;
+        const qint64 end = qMin(total, start + segmentSize) - 1;
+        positions << start;
+        running++;
+
+        QList<mq_httpHeader> headers;
+        headers << mq_httpHeader{ .key = "Range", .value = "bytes=" + QString::number(start) + "-" + QString::number(end) };
+
+        m_mqhttp->stream(_query, headers, "GET", QByteArray(), [&, i](const QByteArray &chunk, int status)
+        {
+            if(status != 206 || failed)
+            {
+                failed = true;
+                return;
+            }
+
+            if(NOT sink->seek(positions[i]) || sink->write(chunk) != chunk.size())
+                failed = true;
+
+            positions[i] += chunk.size();
+            written += chunk.size();
+        }, [&](const mq_reply &reply)
+        {
+            if(reply.error != QNetworkReply::NoError || reply.status != 206)
+                failed = true;
+
+            if(--running == 0)
+                q_eventLoop.quit();
+        });
+    }
+
+    q_eventLoop.exec();
+
+    if(failed || written != total)
+    {
+        if(showDebug)
+            qDebug() << "Segmented download failed, downloading in one request" << name;
+
+        sink->resize(0);
+        sink->seek(0);
+        return getAttachment(database, id, name, sink);
+    }
+
+    _mq_attachmentDownload download = { .ok = true, .status = 206, .bytes = written, .totalSize = total,
+                                        .digest = attachmentDigest(head), .verified = false,
+                                        .mimeType = QString::fromLatin1(mq_replyHeader(head, "Content-Type")) };
+    return download;
+}
+
+QString mqcouch::attachmentDigest(const mq_reply &reply)
+{
+    const QByteArray contentMd5 = mq_replyHeader(reply, "Content-MD5");
+    if(NOT contentMd5.isEmpty())
+        return "md5-" + QString::fromLatin1(contentMd5);
+
+    //ETag of an attachment is its base64 md5 digest
+    QByteArray etag = mq_replyHeader(reply, "ETag");
+    if(etag.startsWith('"') && etag.endsWith('"') && etag.size() >= 2)
+        etag = etag.mid(1, etag.size() - 2);
+
+    return etag.isEmpty() ? QString() : "md5-" + QString::fromLatin1(etag);
+}
+
 bool mqcouch::removeAttachmentFromDocument(QString database, _mq_document fdoc, QString attachmentName)
 {
-    QString _query = databaseUrl + "/" + database + "/" + fdoc.id + "/" + attachmentName + "?rev=" + fdoc.rev;
+    QString _query = nodeUrl(database, true) + "/" + database + "/" + fdoc.id + "/" + attachmentName + "?rev=" + fdoc.rev;
 
     QJsonDocument m_doc = m_mqhttp->custom(_query, m_list, "DELETE", JSON).toJsonDocument();
+    invalidateCached(database, fdoc.id);
     QJsonObject entity = m_doc.object();
 
     /*
@@ -582,17 +1667,24 @@ bool mqcouch::removeAttachmentFromDocument(QString database, _mq_document fdoc,
 
 bool mqcouch::checkDatabase(QString databaseName)
 {
-    for(auto db : allDatabases())
+    QString _query = nodeUrl(databaseName) + "/" + databaseName;
+
+    //HEAD /db answers 200 or 404 without listing every database
+    mq_reply reply = m_mqhttp->exec(_query, m_list, "HEAD");
+
+    if(reply.status == 200)
     {
-        if(db == databaseName)
-            return true;
+        m_knownDatabases.insert(databaseName);
+        return true;
     }
+
+    m_knownDatabases.remove(databaseName);
     return false;
 }
 
 QStringList mqcouch::allDatabases()
 {
-    QString _query = databaseUrl + "/" + "_all_dbs";
+    QString _query = nodeUrl() + "/" + "_all_dbs";
     QJsonDocument doc = m_mqhttp->custom(_query, m_list, "GET", JSON).toJsonDocument();
     QStringList results;
 
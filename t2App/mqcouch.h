@@ -5,12 +5,19 @@
 
 #include "mqhttp.h"
 #include "mqcouch_types.h"
+#include "mqrowparser.h"
+#include "mqchanges.h"
+#include "mqcache.h"
+#include "mqcluster.h"
+#include "mqdocument.h"
+#include "mqmapping.h"
 
 #include <QDebug>
 #include <QPair>
 #include <QList>
 #include <QString>
 #include <QStringList>
+#include <QVector>
 
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -19,8 +26,23 @@
 #include <QJsonParseError>
 
 #include <QFile>
+#include <QFileDevice>
 #include <QFileInfo>
+#include <QCryptographicHash>
 #include <QMimeDatabase>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+
+#include <functional>
+
+//Completion handlers of asynchronous document operations
+typedef std::function<void(_mq_documentRaw)> mq_documentCallback;
+typedef std::function<void(mqdocument)> mq_lazyDocumentCallback;
+typedef std::function<void(_mq_document)> mq_writeCallback;
+typedef std::function<void(_mq_document)> mq_listCallback;
+typedef std::function<void(const _mq_viewRow &)> mq_viewCallback;
+typedef std::function<void(const QJsonObject &)> mq_findCallback;
 
 class mqcouch : public QObject
 {
@@ -28,6 +50,12 @@ class mqcouch : public QObject
 public:
     explicit mqcouch(mqhttp *t, bool debug = true, QObject *parent = 0);
     explicit mqcouch(mqhttp *t, QString connectionUrl, bool debug = true, QObject *parent = 0);
+    /**
+     * @brief Client of a cluster, requests are spread over the healthy nodes
+     * @param nodes node urls, ex. http://10.0.0.1:5984, configure balancing through cluster()
+     */
+    explicit mqcouch(mqhttp *t, QStringList nodes, bool debug = true, QObject *parent = 0);
+    ~mqcouch();
 
     /// @return Returns database connection is alive
     bool isActive();
@@ -60,6 +88,59 @@ public:
      */
     _mq_documentRaw getDocument(QString database, QString id);
 
+    /**
+     * @brief Get document from database without blocking, requests are pipelined by mqhttp's scheduler
+     * @param database collection name
+     * @param id document's id for getting data
+     * @param callback receives the document, empty id on failure
+     * @param priority scheduler priority of the request
+     */
+    void getDocument(QString database, QString id, mq_documentCallback callback, requestPriority priority = PRIORITY_NORMAL);
+
+    /**
+     * @brief Get document without parsing it, the body is kept as received
+     * @note bypasses the document cache, id()/rev() are read without building a DOM
+     * @param database collection name
+     * @param id document's id for getting data
+     * @return null mqdocument on failure
+     */
+    mqdocument getDocumentLazy(QString database, QString id);
+
+    /**
+     * @brief Get document without parsing it and without blocking
+     * @param callback receives the document, null on failure
+     * @param priority scheduler priority of the request
+     */
+    void getDocumentLazy(QString database, QString id, mq_lazyDocumentCallback callback, requestPriority priority = PRIORITY_NORMAL);
+
+    /**
+     * @brief Keep read documents in a bounded LRU cache, repeat getDocument calls send If-None-Match
+     * @note writes through mqcouch invalidate their documents, writes from other clients are caught by the ETag check
+     * @param maxEntries documents kept, 0 disables the cache
+     * @param maxBytes raw response bytes kept, 0 disables the cache
+     */
+    void setDocumentCache(int maxEntries, qint64 maxBytes);
+
+    /// @return cache with hit/miss counters and invalidation, nullptr while it is disabled
+    mqcache *documentCache() const { return m_cache; }
+
+    /// @return node set of a cluster client, nullptr for a single server
+    mqcluster *cluster() const { return m_cluster; }
+
+    /**
+     * @brief Get last revision of a document without downloading it
+     * @param database collection name
+     * @param id document identification
+     * @return revision string from a HEAD request's ETag, empty when the document is missing
+     */
+    QString getRevision(QString database, QString id);
+
+    /**
+     * @brief Retry updateDocument(id)/removeDocument(id) on 409 Conflict with a freshly resolved revision
+     * @param retries extra attempts, 0 (default) fails on the first conflict
+     */
+    void setConflictRetries(int retries) { m_conflictRetries = qMax(0, retries); }
+
     /**
      * @brief Get document from database
      * @param database collection name
@@ -70,6 +151,23 @@ public:
     _mq_documentRaw getDocumentRevision(QString database, QString id, QString request_rev);
 
 
+    /**
+     * @brief Get many documents in one request with _bulk_get
+     * @note falls back to an _all_docs keys POST on servers without _bulk_get
+     * @param database collection name
+     * @param ids documents' ids for getting data
+     * @return one _mq_documentRaw per id in the same order, error is set for missing ids
+     */
+    QList<_mq_documentRaw> getDocuments(QString database, QStringList ids);
+
+    /**
+     * @brief Get pinned revisions of many documents in one request with _bulk_get
+     * @param database collection name
+     * @param documents id and needed-revision pairs
+     * @return one _mq_documentRaw per requested document in the same order, error is set for missing ones
+     */
+    QList<_mq_documentRaw> getDocumentsRevision(QString database, QList<_mq_document> documents);
+
     /**
      * @brief Get All Document in database(collection for my understanding, i used mongo before)
      * @param database collection name
@@ -82,9 +180,137 @@ public:
      * @param database collection name
      * @param limitValue for limiting requested rows
      * @param reversed is defaultly false, it's connected directly to query input, has not any list manipulation
+     * @param startKey id of the first row, empty starts at the beginning (or the end when reversed)
      * @return List of documents with last revision keys, id and raw QJsonDocument
      */
-    QList<_mq_document> getDocumentList(QString database, int limitValue, bool reversed = false);
+    QList<_mq_document> getDocumentList(QString database, int limitValue, bool reversed = false, QString startKey = QString());
+
+    /**
+     * @brief Get All Document in database row by row while the response downloads
+     * @param database collection name
+     * @param callback called for every row with id and last revision, before the next rows arrive
+     * @return response was complete and well-formed
+     */
+    bool streamDocumentList(QString database, mq_listCallback callback);
+
+    /**
+     * @brief Query a design document view, rows are delivered while the response downloads
+     * @param database collection name
+     * @param design design document name without the _design/ prefix
+     * @param view view name
+     * @param options keys, range, paging, reduce/group and index freshness. keys are sent with POST
+     * @param callback called for every row, memory use does not grow with the result size
+     * @param envelope optional, receives total_rows and offset
+     * @return response was complete and well-formed
+     */
+    bool queryView(QString database, QString design, QString view, _mq_viewOptions options, mq_viewCallback callback,
+                   QJsonObject *envelope = nullptr);
+
+    /**
+     * @brief Query a design document view and collect its rows
+     * @return rows in view order, empty on failure
+     */
+    QList<_mq_viewRow> queryView(QString database, QString design, QString view, _mq_viewOptions options = _mq_viewOptions());
+
+    /**
+     * @brief Run a Mango query with _find, documents are delivered while the response downloads
+     * @param database collection name
+     * @param options selector, projection, sort, page size and bookmark
+     * @param callback called for every matching document
+     * @return bookmark of the next page, warning and execution stats. docs stays empty
+     * @note a query without a usable index scans the whole database, it emits findWarning()
+     */
+    _mq_findResult find(QString database, _mq_findOptions options, mq_findCallback callback);
+
+    /**
+     * @brief Run a Mango query with _find and collect one page
+     * @return documents of the page, continue with options.bookmark = result.bookmark until docs is empty
+     */
+    _mq_findResult find(QString database, _mq_findOptions options);
+
+    /**
+     * @brief Create a Mango index with _index
+     * @param fields indexed fields, ex. ["year", "name"] or [{"year": "desc"}]
+     * @param name index name, generated by the server when empty
+     * @param ddoc design document, generated by the server when empty
+     * @param partialFilter optional selector limiting the indexed documents
+     * @return index exists afterwards, also true when it already existed
+     */
+    bool createIndex(QString database, QJsonArray fields, QString name = QString(), QString ddoc = QString(),
+                     QJsonObject partialFilter = QJsonObject());
+
+    /// @return indexes of a database, including the special _all_docs index
+    QList<_mq_index> getIndexes(QString database);
+
+    /**
+     * @brief Delete a Mango index
+     * @param ddoc design document with or without the _design/ prefix
+     */
+    bool removeIndex(QString database, QString ddoc, QString name, QString type = "json");
+
+    /**
+     * @brief Follow database changes instead of polling getDocumentList
+     * @param database collection name
+     * @param options feed style (normal/longpoll/continuous), since, filters and checkpoint file
+     * @return started subscriber owned by mqcouch, connect to its changes() signal
+     */
+    mqchanges *subscribeChanges(QString database, _mq_changesOptions options = _mq_changesOptions());
+
+    //Paginated iteration over _all_docs
+    class mqcursor
+    {
+        public:
+            mqcursor(mqcouch *connection, const QString databaseName, const _mq_cursorOptions options)
+            {
+                m_connection = connection;
+                m_databaseName = databaseName;
+                m_options = options;
+                m_nextKey = options.startKey;
+            }
+
+            /// @return false when every row in the range is consumed, fetches the next page if needed
+            inline bool hasNext()
+            {
+                if(m_index >= m_page.count() && NOT m_exhausted)
+                {
+                    m_page = m_connection->documentPage(m_databaseName, m_options, m_nextKey, &m_nextKey, &m_error);
+                    m_index = 0;
+                    m_exhausted = m_nextKey.isNull() || failed();
+                }
+                return m_index < m_page.count();
+            }
+
+            /// @return next row, call hasNext() first
+            inline _mq_document next()
+            {
+                return m_page.at(m_index++);
+            }
+
+            /// @return true when hasNext() stopped because a page request failed, not at the end of the range
+            inline bool failed() const { return NOT m_error.isEmpty(); }
+            inline QString errorString() const { return m_error; }
+
+        private:
+            mqcouch *m_connection;
+            QString m_databaseName;
+            _mq_cursorOptions m_options;
+            QList<_mq_document> m_page;
+            int m_index = 0;
+            QString m_nextKey;
+            bool m_exhausted = false;
+            QString m_error;
+    };
+
+    /**
+     * @brief Iterate all documents page by page instead of loading the whole _all_docs response
+     * @param database collection name
+     * @param options page size, order and key range
+     * @return cursor, ex. while(cursor.hasNext()) cursor.next();
+     */
+    mqcursor documentCursor(QString database, _mq_cursorOptions options = _mq_cursorOptions())
+    {
+        return mqcursor(this, database, options);
+    }
 
     /**
      * @brief It converts revision pair to raw string for usable to query
@@ -114,6 +340,104 @@ public:
      */
     _mq_document addDocument(QString database, QJsonDocument body);
 
+    /**
+     * @brief Add a new document from already serialized JSON, bytes are sent untouched
+     * @param database collection name
+     * @param body encoded JSON object
+     * @return _mq_document type includes first revision, id and ok states
+     */
+    _mq_document addDocument(QString database, QByteArray body);
+
+    /**
+     * @brief Add a new document to database without blocking, requests are pipelined by mqhttp's scheduler
+     * @param database collection name
+     * @param body QJsonDocument raw data
+     * @param callback receives first revision, id and ok states
+     * @param priority scheduler priority of the request
+     */
+    void addDocument(QString database, QJsonDocument body, mq_writeCallback callback, requestPriority priority = PRIORITY_NORMAL);
+    void addDocument(QString database, QByteArray body, mq_writeCallback callback, requestPriority priority = PRIORITY_NORMAL);
+
+    /**
+     * @brief Add a mapped struct, it is written straight to JSON bytes without a QJsonObject
+     * @note declare the struct with MQ_MAPPING, an empty "_id" member lets the server pick the id
+     * @return id and revision of the new document
+     */
+    template<typename T>
+    _mq_document addTypedDocument(QString database, const T &document)
+    {
+        return addDocument(database, mq_toJson(document));
+    }
+
+    /// @brief Add many mapped structs in one _bulk_docs request
+    template<typename T>
+    QList<_mq_document> addTypedDocuments(QString database, const QList<T> &documents)
+    {
+        QList<QByteArray> bodies;
+        for(const T &document : documents)
+            bodies << mq_toJson(document);
+
+        return addDocuments(database, bodies);
+    }
+
+    /**
+     * @brief Read a document straight into a mapped struct, fields it does not declare are skipped
+     * @return false when the document is missing or does not match the struct
+     */
+    template<typename T>
+    bool getTypedDocument(QString database, QString id, T *document)
+    {
+        mqdocument raw = getDocumentLazy(database, id);
+        return NOT raw.isNull() && mq_fromJson(raw.raw(), document);
+    }
+
+    /**
+     * @brief Replace a document with a mapped struct on its last revision
+     * @note the struct's "_rev" member is not sent, the revision is resolved like updateDocument(id).
+     *       A body rev next to the resolved ?rev= would fail with 400 after any concurrent write
+     */
+    template<typename T>
+    _mq_document updateTypedDocument(QString database, const T &document, QString id)
+    {
+        return updateDocument(database, mq_toJsonExcept(document, "_rev"), id);
+    }
+
+    /**
+     * @brief Add many documents in one request with _bulk_docs
+     * @param database collection name
+     * @param documents QJsonDocument list, _id/_rev inside a document updates it
+     * @return one _mq_document per input document in the same order, ok is false for rejected rows
+     */
+    QList<_mq_document> addDocuments(QString database, QList<QJsonDocument> documents);
+    QList<_mq_document> addDocuments(QString database, QList<QByteArray> documents);
+
+    /**
+     * @brief Buffer documents of a database and write them with _bulk_docs
+     * @param database collection name
+     * @param maxDocuments buffer is flushed when it holds that many documents, 0 disables buffering
+     * @param lingerMs buffer is flushed that long after its first document, 0 waits for size or flush()
+     * @note buffered documents are lost if they are not flushed before mqcouch is destroyed
+     */
+    void setBulkBuffering(QString database, int maxDocuments, int lingerMs = 0);
+
+    /// @return database has buffering enabled by setBulkBuffering
+    bool isBulkBuffered(QString database) const;
+
+    /**
+     * @brief Add document into the bulk buffer, flushing it when the size limit is reached
+     * @param database collection name
+     * @param body QJsonDocument raw data
+     */
+    void bufferDocument(QString database, QJsonDocument body);
+    void bufferDocument(QString database, QByteArray body);
+
+    /**
+     * @brief Write buffered documents now
+     * @param database collection name
+     * @return per document results of the flushed buffer, also emitted by bulkFlushed
+     */
+    QList<_mq_document> flush(QString database);
+
     /**
      * @brief Update document with using id
      * @param database collection name
@@ -123,6 +447,15 @@ public:
      */
     _mq_document updateDocument(QString database, QJsonDocument body, QString id);
 
+    /**
+     * @brief Update document with using id from already serialized JSON, bytes are sent untouched
+     * @param database collection name
+     * @param body encoded JSON object
+     * @param id for finding document
+     * @return _mq_document type includes last revision, id and ok states
+     */
+    _mq_document updateDocument(QString database, QByteArray body, QString id);
+
     /**
      * @brief Update document with using _mq_document type
      * @param database collection name
@@ -131,6 +464,7 @@ public:
      * @return _mq_document type includes last revision, id and ok states
      */
     _mq_document updateDocument(QString database, QJsonDocument body, _mq_document fdoc);
+    _mq_document updateDocument(QString database, QByteArray body, _mq_document fdoc);
 
 
     /**
@@ -184,6 +518,42 @@ public:
      */
     bool addAttachmentToDocumentRaw(QString database, _mq_document fdoc, _mq_attachment attachment);
 
+    /**
+     * @brief Add attachment into document, body is read from device while it is uploaded
+     * @note progress is reported by attachmentUploadProgress, cancelAttachmentUpload stops it
+     * @param database collection name
+     * @param fdoc for finding it, rev must be the last revision
+     * @param name attachment name
+     * @param mimeType attachment content type
+     * @param device open for reading, only a small buffer of it is in memory at a time
+     * @param size body length, -1 uses the remaining size of a random-access device
+     * @return state of success
+     */
+    bool addAttachmentToDocumentStream(QString database, _mq_document fdoc, QString name, QString mimeType, QIODevice *device, qint64 size = -1);
+
+    /**
+     * @brief Download attachment into sink, chunks are written as they arrive
+     * @param database collection name
+     * @param id document identification
+     * @param name attachment name
+     * @param sink open for writing, ex. QFile
+     * @param offset first byte to get, a Range request is sent when it is not 0 (resuming)
+     * @param length bytes to get from offset, -1 to the end
+     * @return written bytes, digest and verification result
+     */
+    _mq_attachmentDownload getAttachment(QString database, QString id, QString name, QIODevice *sink, qint64 offset = 0, qint64 length = -1);
+
+    /**
+     * @brief Download attachment with parallel Range requests, each segment is written at its own position
+     * @param database collection name
+     * @param id document identification
+     * @param name attachment name
+     * @param sink file open for writing, it is resized to the attachment length
+     * @param segments parallel requests, limited by mqhttp's in-flight window
+     * @return written bytes and digest, falls back to getAttachment when ranges are not available
+     */
+    _mq_attachmentDownload getAttachmentSegmented(QString database, QString id, QString name, QFileDevice *sink, int segments = 4);
+
     /**
      * @brief removeAttachmentFromDocument remove with filename
      * @param database collection name
@@ -205,10 +575,35 @@ public:
 
             inline mqdatabase &operator <<(const QJsonDocument &doc)
             {
-                m_connection->addDocument(m_databaseName, doc);
+                return *this << doc.toJson(QJsonDocument::Compact);
+            }
+
+            //Already serialized JSON, written without parsing
+            inline mqdatabase &operator <<(const QByteArray &doc)
+            {
+                if(m_connection->isBulkBuffered(m_databaseName))
+                    m_connection->bufferDocument(m_databaseName, doc);
+                else
+                    m_connection->addDocument(m_databaseName, doc);
                 return *this;
             }
 
+            /**
+             * @brief Collect documents written with << and send them through _bulk_docs
+             * @param maxDocuments flush size, 0 goes back to one request per document
+             * @param lingerMs flush delay after the first buffered document, 0 disables it
+             */
+            inline void setBuffered(int maxDocuments, int lingerMs = 0)
+            {
+                m_connection->setBulkBuffering(m_databaseName, maxDocuments, lingerMs);
+            }
+
+            /// @return per document results of buffered writes
+            inline QList<_mq_document> flush()
+            {
+                return m_connection->flush(m_databaseName);
+            }
+
             inline void operator = (const mqdatabase &d)
             {
                 this->m_databaseName = d.m_databaseName;
@@ -222,12 +617,13 @@ public:
 
     /**
      * @brief getDatabase If couchDB contains that collection, returns it back. Except that, it will be create automatically.
+     * @note databases seen once are remembered, later calls don't touch the network until removeDatabase or forgetDatabases
      * @param database collection name
      * @return object
    */
     mqdatabase getDatabase(QString databaseName)
     {
-        if(checkDatabase(databaseName))
+        if(m_knownDatabases.contains(databaseName) || checkDatabase(databaseName))
         {
             return mqdatabase(this, databaseName);
         }
@@ -238,6 +634,9 @@ public:
         }
     }
 
+    /// @brief Drop remembered database handles, ex. after databases are deleted by another client
+    void forgetDatabases() { m_knownDatabases.clear(); }
+
     /**
      * @brief checkDatabase Check the database on couchDB
      * @param databaseName collection name
@@ -272,7 +671,54 @@ public:
      */
     QJsonObject informationDatabase(QString databaseName);
     _mq_databaseInfo informationDatabaseStruct(QString databaseName);
+public slots:
+    /// @brief Abort the running addAttachmentToDocument/addAttachmentToDocumentStream upload
+    void cancelAttachmentUpload();
+
+signals:
+    /// Bytes sent of the running attachment upload
+    void attachmentUploadProgress(qint64 bytesSent, qint64 bytesTotal);
+
+    /**
+     * @brief Emitted after buffered documents are written
+     * @param database collection name
+     * @param results one _mq_document per buffered document in write order
+     */
+    void bulkFlushed(QString database, QList<_mq_document> results);
+
+    /// A _find query was answered with a warning, ex. it had no usable index and scanned every document
+    void findWarning(QString database, QString warning);
 private:
+    //Pending _bulk_docs payload of a buffered database
+    typedef struct _mq_bulkBuffer{
+        QByteArray payload;
+        int count;
+        int maxDocuments;
+        int lingerMs;
+        QTimer *timer;
+    } _mq_bulkBuffer;
+
+    //Base url of the next request, picked by the cluster when there is one
+    QString nodeUrl(const QString &database = QString(), bool write = false);
+    void recordRetry(const QString &operation, const QString &database);
+    _mq_documentRaw documentFromReply(const QString &database, const QString &id, const mq_reply &reply, _mq_cacheEntry *cached);
+    void invalidateCached(const QString &database, const QString &id);
+    bool streamRows(QString query, QString verb, QByteArray body, QByteArray arrayKey, mq_rowCallback callback,
+                    QJsonObject *envelope = nullptr, mq_reply *reply = nullptr);
+    QList<_mq_document> documentPage(QString database, const _mq_cursorOptions &options, QString startKey, QString *nextKey,
+                                     QString *errorString);
+    static QByteArray encodeKey(const QString &key);
+    static QByteArray encodeKey(const QJsonValue &key);
+
+    static QString attachmentDigest(const mq_reply &reply);
+
+    QList<_mq_documentRaw> bulkGet(QString database, QJsonArray docs);
+    QList<_mq_documentRaw> allDocsKeys(QString database, QStringList ids);
+
+    static QByteArray bulkPayload(const QByteArray &joinedDocuments);
+    static QList<_mq_document> bulkResults(const mq_reply &reply, int count);
+    void flushLater(QString database);
+
     //Main http request/response object
     mqhttp *m_mqhttp;
     //Requests headers
@@ -284,6 +730,23 @@ private:
     QMimeDatabase mimedb;
     //Debug Status
     bool showDebug;
+
+    //Ticket of the running attachment upload
+    quint64 m_uploadTicket = 0;
+
+    //Databases known to exist, filled by checkDatabase/createDatabase
+    QSet<QString> m_knownDatabases;
+
+    //Extra attempts of id based writes after 409 Conflict
+    int m_conflictRetries = 0;
+
+    //Document cache, disabled by default
+    mqcache *m_cache = nullptr;
+    //Node selection of a cluster client
+    mqcluster *m_cluster = nullptr;
+
+    //Bulk write buffers, keyed by database name
+    QHash<QString, _mq_bulkBuffer> m_bulkBuffers;
 };
 
 #endif // MQCOUCH_H
@@ -32,12 +32,154 @@ typedef struct _mq_documentRaw{
     QString id;
     QString rev;
     QJsonDocument data;
+    //Filled by batch fetches when that id could not be read, ex. "not_found: missing"
+    QString error;
 } _mq_documentRaw;
 
+typedef struct _mq_attachmentDownload{
+    bool ok;
+    int status;
+    //Bytes written into the sink
+    qint64 bytes;
+    //Full attachment length, -1 when the server didn't tell
+    qint64 totalSize;
+    //Attachment digest from the server, ex. "md5-yDbs1scfYdqqLpxyFb1gFw=="
+    QString digest;
+    //Digest matched the downloaded bytes, only checked on full downloads with an md5 digest
+    bool verified;
+    QString mimeType;
+} _mq_attachmentDownload;
+
+typedef struct _mq_cursorOptions{
+    //Rows fetched per _all_docs request, memory use stays bounded by it
+    int pageSize = 1000;
+    bool descending = false;
+    //Key range in iteration order, empty means unbounded
+    QString startKey;
+    QString endKey;
+    bool inclusiveEnd = true;
+} _mq_cursorOptions;
+
+//_changes feed styles
+enum changesFeed{
+    FEED_NORMAL = 0,
+    FEED_LONGPOLL = 1,
+    FEED_CONTINUOUS = 2
+};
+
+typedef struct _mq_changesOptions{
+    changesFeed feed = FEED_LONGPOLL;
+    //Sequence to start after, "now" skips history. A stored checkpoint overrides it
+    QString since = "0";
+    //Changes per request, 0 is unlimited
+    int limit = 0;
+    bool includeDocs = false;
+    //Design document filter ex. "app/important", ignored when selector is set
+    QString filter;
+    //Mango selector, sent with filter=_selector
+    QJsonObject selector;
+    //Server keep-alive interval in ms, the feed reconnects after two silent intervals
+    int heartbeat = 30000;
+    //File keeping last_seq between runs, empty disables checkpointing
+    QString checkpointFile;
+} _mq_changesOptions;
+
+typedef struct _mq_change{
+    QString seq;
+    QString id;
+    QStringList revs;
+    bool deleted;
+    //Only filled with includeDocs
+    QJsonObject doc;
+} _mq_change;
+
 typedef struct _mq_attachment{
     QString name;
     QString mimeType;
     QByteArray body;
 } _mq_attachment;
 
+//Index freshness of view queries
+enum viewUpdate{
+    VIEW_UPDATE = 0,        //index catches up before answering (default)
+    VIEW_UPDATE_FALSE = 1,  //answer from the index as it is, ex. stale=ok
+    VIEW_UPDATE_LAZY = 2    //answer now and update afterwards, ex. stale=update_after
+};
+
+typedef struct _mq_viewOptions{
+    //Keys are JSON values, ex. QJsonValue("abc") or QJsonArray{2017, 10}. Undefined means unset
+    QJsonValue key = QJsonValue(QJsonValue::Undefined);
+    QJsonValue startKey = QJsonValue(QJsonValue::Undefined);
+    QString startKeyDocId;
+    QJsonValue endKey = QJsonValue(QJsonValue::Undefined);
+    QString endKeyDocId;
+    bool inclusiveEnd = true;
+    //Many keys at once, sent as a POST body so the url stays short
+    QJsonArray keys;
+    //Rows returned, -1 is unlimited
+    int limit = -1;
+    int skip = 0;
+    bool descending = false;
+    bool includeDocs = false;
+    //false queries the map part of a view with a reduce function
+    bool reduce = true;
+    bool group = false;
+    //Group by the first n elements of array keys, -1 leaves it unset
+    int groupLevel = -1;
+    viewUpdate update = VIEW_UPDATE;
+    //Same shard replicas for every request, with VIEW_UPDATE_FALSE it is stale=ok
+    bool stable = false;
+} _mq_viewOptions;
+
+typedef struct _mq_viewRow{
+    //Empty for reduced rows
+    QString id;
+    QJsonValue key;
+    QJsonValue value;
+    //Only filled with includeDocs
+    QJsonObject doc;
+    //Set for keys without rows, ex. "not_found"
+    QString error;
+} _mq_viewRow;
+
+typedef struct _mq_findOptions{
+    //Mango selector, ex. {"year": {"$gt": 2010}}
+    QJsonObject selector;
+    //Projection, empty returns whole documents
+    QStringList fields;
+    //ex. [{"year": "desc"}], sorted fields need an index
+    QJsonArray sort;
+    //Documents per page, -1 keeps the server default (25)
+    int limit = -1;
+    int skip = 0;
+    //Continue after a previous page, taken from _mq_findResult::bookmark
+    QString bookmark;
+    //Design document (and index name) to use, ex. "_design/by-year"
+    QString useIndex;
+    bool executionStats = false;
+} _mq_findOptions;
+
+typedef struct _mq_findResult{
+    bool ok = false;
+    //Matching documents, empty when a row callback consumed them
+    QList<QJsonObject> docs;
+    //Pass to the next query for the following page
+    QString bookmark;
+    //Server hint, ex. no matching index and the query scanned every document
+    QString warning;
+    //total_docs_examined, results_returned, execution_time_ms ... with executionStats
+    QJsonObject executionStats;
+    //Server error and reason, ex. "no_usable_index"
+    QString error;
+} _mq_findResult;
+
+typedef struct _mq_index{
+    QString ddoc;
+    QString name;
+    //json, text or special (_all_docs)
+    QString type;
+    //{"fields": [...]} and partial_filter_selector when set
+    QJsonObject definition;
+} _mq_index;
+
 #endif // MQCOUCH_TYPES_H
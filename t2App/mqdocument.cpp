@@ -0,0 +1,157 @@
+/**
+ *  @file    mqdocument.cpp
+ *
+ *  @brief Lazily parsed document
+ *
+ *  @section DESCRIPTION
+ *
+ *  Holds a document as raw JSON bytes, extracts top-level fields by scanning
+ *  and parses the whole body only on first access
+ */
+
+#include "mqdocument.h"
+
+QString mqdocument::id() const
+{
+    if(m_parsed)
+        return m_document.object()["_id"].toString();
+
+    return value("_id").toString();
+}
+
+QString mqdocument::rev() const
+{
+    if(m_parsed)
+        return m_document.object()["_rev"].toString();
+
+    return value("_rev").toString();
+}
+
+QJsonValue mqdocument::value(const QByteArray &key) const
+{
+    if(m_parsed)
+        return m_document.object()[QString::fromUtf8(key)];
+
+    int begin, end;
+    if(NOT findValue(m_raw, key, &begin, &end))
+        return QJsonValue(QJsonValue::Undefined);
+
+    //Wrapping the value in an array lets QJsonDocument decode any JSON value, escapes included
+    const QByteArray wrapped = "[" + m_raw.mid(begin, end - begin) + "]";
+    return QJsonDocument::fromJson(wrapped).array().at(0);
+}
+
+QJsonDocument mqdocument::document() const
+{
+    if(NOT m_parsed)
+    {
+        m_document = QJsonDocument::fromJson(m_raw);
+        m_parsed = true;
+    }
+
+    return m_document;
+}
+
+_mq_documentRaw mqdocument::toRaw() const
+{
+    _mq_documentRaw data;
+    data.data = document();
+    data.id = id();
+    data.rev = rev();
+
+    return data;
+}
+
+bool mqdocument::findValue(const QByteArray &raw, const QByteArray &key, int *begin, int *end)
+{
+    const char *data = raw.constData();
+    const int size = raw.size();
+
+    int depth = 0;
+    int stringStart = -1;
+    int lastString = -1, lastStringEnd = -1;
+
+    for(int i = 0; i < size; i++)
+    {
+        const char c = data[i];
+
+        if(stringStart >= 0)
+        {
+            if(c == '\\')
+                i++;
+            else if(c == '"')
+            {
+                lastString = stringStart;
+                lastStringEnd = i;
+                stringStart = -1;
+            }
+            continue;
+        }
+
+        if(c == '"')
+            stringStart = i + 1;
+        else if(c == '{' || c == '[')
+            depth++;
+        else if(c == '}' || c == ']')
+        {
+            depth--;
+            if(depth == 0)
+                return false;
+        }
+        else if(c == ':' && depth == 1 && lastStringEnd - lastString == key.size()
+                && qstrncmp(data + lastString, key.constData(), key.size()) == 0)
+        {
+            //Key matched, find where its value ends
+            int j = i + 1;
+            while(j < size && (data[j] == ' ' || data[j] == '\t' || data[j] == '\n' || data[j] == '\r'))
+                j++;
+
+            *begin = j;
+
+            int valueDepth = 0;
+            bool inString = false;
+            for(; j < size; j++)
+            {
+                const char v = data[j];
+
+                if(inString)
+                {
+                    if(v == '\\')
+                        j++;
+                    else if(v == '"')
+                    {
+                        inString = false;
+                        if(valueDepth == 0)
+                        {
+                            *end = j + 1;
+                            return true;
+                        }
+                    }
+                    continue;
+                }
+
+                if(v == '"')
+                    inString = true;
+                else if(v == '{' || v == '[')
+                    valueDepth++;
+                else if(v == '}' || v == ']')
+                {
+                    if(valueDepth == 0)
+                        break;
+                    if(--valueDepth == 0)
+                    {
+                        *end = j + 1;
+                        return true;
+                    }
+                }
+                else if(v == ',' && valueDepth == 0)
+                    break;
+            }
+
+            *end = j;
+            return *end > *begin;
+        }
+    }
+
+    return false;
+}
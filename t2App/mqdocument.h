@@ -0,0 +1,60 @@
+#ifndef MQDOCUMENT_H
+#define MQDOCUMENT_H
+
+#include "mqcouch_types.h"
+
+#include <QByteArray>
+#include <QString>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonValue>
+
+/**
+ * @brief Document kept as the response bytes, JSON is parsed only when it is needed
+ *
+ * The raw QByteArray is implicitly shared, copying an mqdocument or forwarding
+ * raw() never copies the body. id(), rev() and value() scan the top-level object
+ * and decode only the requested field, document() builds the full DOM once.
+ */
+class mqdocument
+{
+public:
+    mqdocument() {}
+    explicit mqdocument(const QByteArray &raw) : m_raw(raw) {}
+
+    bool isNull() const { return m_raw.isEmpty(); }
+
+    /// @return response bytes as received, shared with this object
+    const QByteArray &raw() const { return m_raw; }
+
+    /// @return _id without building a DOM
+    QString id() const;
+    /// @return _rev without building a DOM
+    QString rev() const;
+
+    /**
+     * @brief Decode one top-level field without parsing the rest of the document
+     * @param key field name, keys with escape sequences are not matched
+     * @return field value, undefined when it is missing
+     */
+    QJsonValue value(const QByteArray &key) const;
+
+    /// @return parsed document, built on first access and kept
+    QJsonDocument document() const;
+    QJsonObject object() const { return document().object(); }
+
+    /// @return eager representation used by the rest of the driver
+    _mq_documentRaw toRaw() const;
+
+private:
+    static bool findValue(const QByteArray &raw, const QByteArray &key, int *begin, int *end);
+
+    QByteArray m_raw;
+
+    mutable bool m_parsed = false;
+    mutable QJsonDocument m_document;
+};
+
+#endif // MQDOCUMENT_H
@@ -4,269 +4,816 @@
  *  @date    02/10/2017
  *  @version 1.0
  *
- *  @brief Basic Sync-HTTP Client
+ *  @brief Basic HTTP Client
  *
  *  @section DESCRIPTION
  *
- *  Basic Sync-HTTP Client
+ *  Basic HTTP Client, asynchronous requests with completion callbacks
+ *  and blocking wrappers on top of them
  *  Powered by QNetworkAccessManager
  */
 
 #include "mqhttp.h"
 
+#include <zlib.h>
+#include <cstring>
+
+//Device uploads up to this size are read into memory to be compressed
+static const qint64 COMPRESS_DEVICE_LIMIT = 16 * 1024 * 1024;
+
+QString mq_documentUrl(const QString &node, const QString &database, const QString &id, const QString &query)
+{
+    QString url;
+    url.reserve(node.size() + database.size() + id.size() + query.size() + 3);
+    url.append(node).append('/').append(database).append('/').append(id);
+    if(!query.isEmpty())
+        url.append('?').append(query);
+    return url;
+}
+
 mqhttp::mqhttp(QObject *parent) : QObject(parent)
 {
     sslConf = new QSslConfiguration(QSslConfiguration::defaultConfiguration());
     sslConf->setProtocol(QSsl::TlsV1SslV3);
 
+    m_random.seed(std::random_device()());
+
     m_manager = new QNetworkAccessManager(this);
     connect(m_manager, SIGNAL(sslErrors(QNetworkReply*,QList<QSslError>)), this, SLOT(handleSslErrors(QNetworkReply*,QList<QSslError>)));
 }
 
-QVariant mqhttp::get(QString url, QList<mq_httpHeader> headers, responseType type)
+quint64 mqhttp::request(QString url, QList<mq_httpHeader> headers, QString verb, QByteArray data, mq_callback callback,
+                        requestPriority priority, int deadline)
 {
-    QEventLoop q_eventLoop;
-    QVariant q_response;
+    return stream(url, headers, verb, data, mq_dataCallback(), callback, priority, deadline);
+}
 
-    QNetworkRequest q_request(url);
-    QNetworkReply *m_response;
+quint64 mqhttp::stream(QString url, QList<mq_httpHeader> headers, QString verb, QByteArray data,
+                       mq_dataCallback dataCallback, mq_callback callback, requestPriority priority, int deadline)
+{
+    mq_pendingRequest pending;
+    pending.url = url;
+    pending.headers = headers;
+    pending.verb = verb;
+    pending.data = data;
+    pending.dataCallback = dataCallback;
+    pending.callback = callback;
+
+    return startRequest(pending, priority, deadline);
+}
+
+quint64 mqhttp::upload(QString url, QList<mq_httpHeader> headers, QString verb, QIODevice *device, qint64 size,
+                       mq_callback callback, requestPriority priority, int deadline)
+{
+    mq_pendingRequest pending;
+    pending.url = url;
+    pending.headers = headers;
+    pending.verb = verb;
+    pending.device = device;
+    pending.deviceSize = size;
+    pending.callback = callback;
+    pending.upload = true;
+
+    return startRequest(pending, priority, deadline);
+}
 
-    q_request.setSslConfiguration(*sslConf);
-    connect(m_manager, SIGNAL(finished(QNetworkReply*)), &q_eventLoop, SLOT(quit()));
+quint64 mqhttp::startRequest(mq_pendingRequest &pending, requestPriority priority, int deadline)
+{
+    if(deadline < 0)
+        deadline = m_deadline;
 
-    for(auto header : headers)
-    {
-        q_request.setRawHeader(QByteArray::fromStdString(header.key.toStdString().c_str()),
-                               QByteArray::fromStdString(header.value.toStdString().c_str()));
-    }
+    //Plain single attempt, nothing to track
+    const bool retries = m_retryPolicy.maxRetries > 0 && !pending.device;
+    const bool hedge = m_hedging && !pending.device && !pending.dataCallback && (pending.verb == "GET" || pending.verb == "HEAD");
+    if(!retries && !hedge && deadline == 0)
+        return enqueue(pending, priority);
 
-    m_response = m_manager->get(q_request);
-    q_eventLoop.exec();
+    std::shared_ptr<mq_requestState> state = std::make_shared<mq_requestState>();
+    state->pending = pending;
 
-    if(m_response->error() == QNetworkReply::NoError)
-    {
-        QByteArray response = m_response->readAll();
+    //Retries and hedges resend the same bytes, gzip them once
+    compressBody(state->pending);
+    state->pending.compressed = true;
+    state->priority = priority;
+    state->retryable = retries;
+    state->hedge = hedge;
 
-        if(type == JSON)
-        {
-            QJsonDocument doc = QJsonDocument::fromJson(response);
-            return doc;
-        }
-        else
-            return QString::fromLatin1(response);
-    }
-    else
+    const quint64 ticket = launch(state);
+    if(ticket == 0)
+        return 0;
+
+    state->ticket = ticket;
+    m_requests.insert(ticket, state);
+
+    if(deadline > 0)
     {
-        const QString errorCode = m_response->errorString();
-        return errorCode;
+        QTimer::singleShot(deadline, this, [this, state]()
+        {
+            if(state->done)
+                return;
+
+            mq_reply result;
+            result.status = 0;
+            result.error = QNetworkReply::TimeoutError;
+            result.errorString = "Request deadline exceeded";
+            finishRequest(state, result);
+        });
     }
 
-    return q_response;
+    return ticket;
 }
 
-QVariant mqhttp::post(QString url, QList<mq_httpHeader> headers, QJsonDocument body, responseType type)
+quint64 mqhttp::launch(std::shared_ptr<mq_requestState> state)
 {
-    QEventLoop q_eventLoop;
-    QVariant q_response;
+    mq_pendingRequest pending = state->pending;
+    std::shared_ptr<quint64> ticket = std::make_shared<quint64>(0);
 
-    QNetworkRequest q_request(url);
-    QNetworkReply *m_response;
+    if(state->pending.dataCallback)
+    {
+        pending.dataCallback = [state](const QByteArray &chunk, int status)
+        {
+            if(state->done)
+                return;
 
-    q_request.setSslConfiguration(*sslConf);
-    connect(m_manager, SIGNAL(finished(QNetworkReply*)), &q_eventLoop, SLOT(quit()));
+            state->delivered = true;
+            state->pending.dataCallback(chunk, status);
+        };
+    }
 
-    bool hasContentType = false;
-    for(auto t_header : headers)
+    pending.callback = [this, state, ticket](const mq_reply &reply)
     {
-        if(t_header.key == "Content-Type")
-            hasContentType = true;
-    }
+        attemptFinished(state, *ticket, reply);
+    };
 
-    if( !hasContentType )
-        headers.append(mq_httpHeader{ .key = "Content-Type", .value = "application/json"});
+    *ticket = enqueue(pending, state->priority);
+    if(*ticket == 0)
+        return 0;
 
-    for(auto header : headers)
+    state->running.append(*ticket);
+
+    //Duplicate of a slow read, the first reply wins
+    if(state->hedge && !state->hedged)
     {
-        q_request.setRawHeader(QByteArray::fromStdString(header.key.toStdString().c_str()),
-                               QByteArray::fromStdString(header.value.toStdString().c_str()));
+        QTimer::singleShot(hedgeDelay(state->pending), this, [this, state]()
+        {
+            if(state->done || state->hedged || state->running.isEmpty())
+                return;
+
+            state->hedged = true;
+            launch(state);
+        });
     }
 
-    const QByteArray data = body.toJson();
+    return *ticket;
+}
 
-    m_response = m_manager->post(q_request, data);
-    q_eventLoop.exec();
+void mqhttp::attemptFinished(std::shared_ptr<mq_requestState> state, quint64 ticket, const mq_reply &reply)
+{
+    state->running.removeAll(ticket);
+    if(state->done)
+        return;
 
-    if(m_response->error() == QNetworkReply::NoError)
+    if(shouldRetry(*state, reply))
     {
-        QByteArray response = m_response->readAll();
-        qDebug() << response;
+        //A hedged copy is still on the wire, its reply decides
+        if(!state->running.isEmpty())
+            return;
+
+        //Full jitter: uniform between 0 and the exponential delay
+        const int ceiling = int(qMin<qint64>(m_retryPolicy.maxDelay, qint64(m_retryPolicy.baseDelay) << qMin(state->attempt, 20)));
+        const int delay = std::uniform_int_distribution<int>(0, qMax(0, ceiling))(m_random);
+        state->attempt++;
 
-        if(type == JSON)
+        if(m_metrics)
         {
-            QJsonDocument doc = QJsonDocument::fromJson(response);
-            return doc;
+            QString operation, database;
+            mqmetrics::classify(state->pending.verb, state->pending.url, &operation, &database);
+            m_metrics->recordRetry(operation, database);
         }
-        else
-            return QString::fromLatin1(response);
+
+        QTimer::singleShot(delay, this, [this, state, reply]()
+        {
+            if(state->done)
+                return;
+
+            //A cluster may send the retry to another node
+            auto resolver = m_resolvers.constFind(origin(state->pending.url));
+            if(resolver != m_resolvers.constEnd())
+            {
+                const QString url = resolver->second(state->pending.url);
+                if(!url.isEmpty())
+                    state->pending.url = url;
+            }
+
+            //Queue full, give up with the last failure
+            if(launch(state) == 0)
+                finishRequest(state, reply);
+        });
+        return;
     }
-    else
+
+    //A failed hedge attempt waits for its twin
+    if(reply.error != QNetworkReply::NoError && reply.status == 0 && !state->running.isEmpty())
+        return;
+
+    finishRequest(state, reply);
+}
+
+void mqhttp::finishRequest(std::shared_ptr<mq_requestState> state, const mq_reply &reply)
+{
+    state->done = true;
+    m_requests.remove(state->ticket);
+
+    //Losing hedge copies and attempts cut by the deadline
+    const QList<quint64> running = state->running;
+    state->running.clear();
+    for(quint64 ticket : running)
+        abortTicket(ticket);
+
+    if(state->pending.callback)
+        state->pending.callback(reply);
+}
+
+bool mqhttp::shouldRetry(const mq_requestState &state, const mq_reply &reply) const
+{
+    if(!state.retryable || state.delivered || state.attempt >= m_retryPolicy.maxRetries)
+        return false;
+
+    //Nothing reached the server, every verb is safe to repeat
+    if(reply.error == QNetworkReply::ConnectionRefusedError || reply.error == QNetworkReply::HostNotFoundError)
+        return true;
+
+    if(!isIdempotent(state.pending.verb, state.pending.url))
+        return false;
+
+    //Aborts and deadlines are final
+    if(reply.error == QNetworkReply::OperationCanceledError)
+        return false;
+
+    return (reply.status == 0 && reply.error != QNetworkReply::NoError)
+            || reply.status == 429
+            || (reply.status >= 500 && reply.status != 501);
+}
+
+bool mqhttp::isIdempotent(const QString &verb, const QString &url)
+{
+    if(verb == "GET" || verb == "HEAD")
+        return true;
+    if(verb != "POST")
+        return false;
+
+    //Queries sent as POST only read
+    const QString path = QUrl(url).path();
+    return path.endsWith("/_all_docs") || path.endsWith("/_bulk_get") || path.endsWith("/_find")
+            || path.endsWith("/_explain") || path.contains("/_view/");
+}
+
+int mqhttp::hedgeDelay(const mq_pendingRequest &pending) const
+{
+    if(m_metrics)
     {
-        const QString errorCode = m_response->errorString();
-        return errorCode;
+        QString operation, database;
+        mqmetrics::classify(pending.verb, pending.url, &operation, &database);
+
+        const qint64 p95 = m_metrics->percentile(operation, database, 0.95);
+        if(p95 > 0)
+            return int(qMax<qint64>(1, p95 / 1000));
     }
 
-    return q_response;
+    return m_hedgeDelay;
 }
 
-QVariant mqhttp::put(QString url, QList<mq_httpHeader> headers, QJsonDocument body, responseType type)
+void mqhttp::setHedging(bool enabled, int fallbackDelay)
+{
+    m_hedging = enabled;
+    m_hedgeDelay = qMax(1, fallbackDelay);
+}
+
+quint64 mqhttp::enqueue(mq_pendingRequest &pending, requestPriority priority)
+{
+    if(m_maxQueued > 0 && m_inFlight.count() >= m_maxInFlight && queuedCount() >= m_maxQueued)
+    {
+        cancelled(pending.callback, "Request queue is full");
+        return 0;
+    }
+
+    pending.ticket = ++m_lastTicket;
+    pending.origin = origin(pending.url);
+    m_outstanding[pending.origin]++;
+
+    m_queues[priority].enqueue(pending);
+    schedule();
+    updateBackpressure();
+
+    return pending.ticket;
+}
+
+mq_reply mqhttp::exec(QString url, QList<mq_httpHeader> headers, QString verb, QByteArray data, requestPriority priority,
+                      int deadline)
 {
     QEventLoop q_eventLoop;
-    QVariant q_response;
+    mq_reply result;
+    bool finished = false;
 
-    QNetworkRequest q_request(url);
-    QNetworkReply *m_response;
+    request(url, headers, verb, data, [&](const mq_reply &reply)
+    {
+        result = reply;
+        finished = true;
+        q_eventLoop.quit();
+    }, priority, deadline);
 
-    q_request.setSslConfiguration(*sslConf);
-    connect(m_manager, SIGNAL(finished(QNetworkReply*)), &q_eventLoop, SLOT(quit()));
+    if(!finished)
+        q_eventLoop.exec();
+
+    return result;
+}
 
-    bool hasContentType = false;
-    for(auto t_header : headers)
+quint64 mqhttp::probe(QString url, QList<mq_httpHeader> headers, mq_callback callback, int timeout)
+{
+    mq_pendingRequest pending;
+    pending.ticket = ++m_lastTicket;
+    pending.url = url;
+    pending.headers = headers;
+    pending.verb = "GET";
+    pending.callback = callback;
+    pending.control = true;
+
+    //Started outside the queue, a node check must not wait behind the traffic it decides on
+    m_probes++;
+    start(pending);
+
+    const quint64 ticket = pending.ticket;
+    if(timeout > 0)
     {
-        if(t_header.key == "Content-Type")
-            hasContentType = true;
+        QTimer::singleShot(timeout, this, [this, ticket]()
+        {
+            abortTicket(ticket);
+        });
     }
 
-    if( !hasContentType )
-        headers.append(mq_httpHeader{ .key = "Content-Type", .value = "application/json"});
+    return ticket;
+}
 
-    for(auto header : headers)
+bool mqhttp::abort(quint64 ticket)
+{
+    std::shared_ptr<mq_requestState> state = m_requests.value(ticket);
+    if(state)
     {
-        q_request.setRawHeader(QByteArray::fromStdString(header.key.toStdString().c_str()),
-                               QByteArray::fromStdString(header.value.toStdString().c_str()));
+        mq_reply result;
+        result.status = 0;
+        result.error = QNetworkReply::OperationCanceledError;
+        result.errorString = "Request aborted";
+        finishRequest(state, result);
+        return true;
     }
 
-    const QByteArray data = body.toJson();
-
-    m_response = m_manager->put(q_request, data);
-    q_eventLoop.exec();
+    return abortTicket(ticket);
+}
 
-    if(m_response->error() == QNetworkReply::NoError)
+bool mqhttp::abortTicket(quint64 ticket)
+{
+    if(m_inFlight.contains(ticket))
     {
-        QByteArray response = m_response->readAll();
+        //finished() is emitted with OperationCanceledError and runs the callback
+        m_inFlight.value(ticket)->abort();
+        return true;
+    }
 
-        if(type == JSON)
+    for(QQueue<mq_pendingRequest> &queue : m_queues)
+    {
+        for(int i = 0; i < queue.count(); i++)
         {
-            QJsonDocument doc = QJsonDocument::fromJson(response);
-            return doc;
+            if(queue.at(i).ticket == ticket)
+            {
+                const mq_pendingRequest removed = queue.takeAt(i);
+                const mq_callback callback = removed.callback;
+                release(removed.origin);
+                updateBackpressure();
+                cancelled(callback, "Request aborted before it was sent");
+                return true;
+            }
         }
-        else
-            return QString::fromLatin1(response);
-    }
-    else
-    {
-        const QString errorCode = m_response->errorString();
-        return errorCode;
     }
 
-    return q_response;
+    return false;
 }
 
-QVariant mqhttp::custom(QString url, QList<mq_httpHeader> headers, QString verb, responseType type)
+void mqhttp::setMaxInFlight(int limit)
 {
-    QEventLoop q_eventLoop;
-    QVariant q_response;
+    m_maxInFlight = qMax(1, limit);
+    schedule();
+    updateBackpressure();
+}
 
-    QNetworkRequest q_request(url);
-    QNetworkReply *m_response;
+void mqhttp::setMaxQueued(int limit)
+{
+    m_maxQueued = qMax(0, limit);
+    updateBackpressure();
+}
 
-    q_request.setSslConfiguration(*sslConf);
-    connect(m_manager, SIGNAL(finished(QNetworkReply*)), &q_eventLoop, SLOT(quit()));
+int mqhttp::queuedCount() const
+{
+    int count = 0;
+    for(const QQueue<mq_pendingRequest> &queue : m_queues)
+        count += queue.count();
+    return count;
+}
 
-    for(auto header : headers)
+void mqhttp::schedule()
+{
+    for(int priority = PRIORITY_HIGH; priority >= PRIORITY_LOW; priority--)
     {
-        q_request.setRawHeader(QByteArray::fromStdString(header.key.toStdString().c_str()),
-                               QByteArray::fromStdString(header.value.toStdString().c_str()));
+        while(m_inFlight.count() - m_probes < m_maxInFlight && !m_queues[priority].isEmpty())
+            start(m_queues[priority].dequeue());
     }
+}
 
-    m_response = m_manager->sendCustomRequest(q_request, QByteArray::fromStdString(verb.toStdString()));
-    q_eventLoop.exec();
+void mqhttp::start(const mq_pendingRequest &pending)
+{
+    const quint64 ticket = pending.ticket;
+    const mq_callback callback = pending.callback;
+    const mq_dataCallback dataCallback = pending.dataCallback;
+
+    mq_pendingRequest encoded = pending;
+    if(!encoded.compressed)
+        compressBody(encoded);
 
-    QJsonDocument doc;
-    if(m_response->error() == QNetworkReply::NoError)
+    //Body bytes as they go on the wire, the gzip buffer once compressBody() converted a device
+    qint64 bytesSent = encoded.data.size();
+    if(encoded.device)
+        bytesSent = encoded.deviceSize >= 0 ? encoded.deviceSize
+                  : encoded.device->isSequential() ? 0 : encoded.device->size() - encoded.device->pos();
+
+    QNetworkReply *m_response;
+    if(encoded.device)
+        m_response = dispatch(buildUploadRequest(encoded.url, encoded.headers, encoded.device, encoded.deviceSize), encoded.verb, encoded.device);
+    else
+        m_response = dispatch(buildRequest(encoded.url, encoded.headers, *sslConf), encoded.verb, encoded.data);
+    m_inFlight.insert(ticket, m_response);
+
+    //Request shape for metrics
+    const QString verb = encoded.verb;
+    const QString url = encoded.url;
+    const QString origin = pending.origin;
+    const bool control = pending.control;
+    std::shared_ptr<qint64> bytesReceived = std::make_shared<qint64>(0);
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    if(encoded.upload)
     {
-        QByteArray response = m_response->readAll();
+        //Totals of a converted device are the compressed length, not the size the caller passed
+        const qint64 total = encoded.device ? qint64(-1) : bytesSent;
+        connect(m_response, &QNetworkReply::uploadProgress, this, [this, ticket, total](qint64 sent, qint64 bytesTotal)
+        {
+            emit uploadProgress(ticket, sent, total >= 0 ? total : bytesTotal);
+        });
+    }
 
-        if(type == JSON)
+    if(dataCallback)
+    {
+        //Error bodies are small, they stay in the reply and end up in mq_reply::body
+        connect(m_response, &QNetworkReply::readyRead, this, [m_response, dataCallback, bytesReceived]()
+        {
+            if(isSuccess(m_response))
+            {
+                const QByteArray chunk = m_response->readAll();
+                *bytesReceived += chunk.size();
+                dataCallback(chunk, m_response->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
+            }
+        });
+    }
+
+    connect(m_response, &QNetworkReply::finished, this, [this, m_response, ticket, callback, dataCallback,
+            verb, url, origin, control, bytesSent, bytesReceived, elapsed]()
+    {
+        mq_reply result;
+        result.status = m_response->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        result.error = m_response->error();
+        if(result.error != QNetworkReply::NoError)
+            result.errorString = m_response->errorString();
+        if(dataCallback && isSuccess(m_response))
         {
-            doc = QJsonDocument::fromJson(response);
-            return doc;
+            const QByteArray chunk = m_response->readAll();
+            *bytesReceived += chunk.size();
+            dataCallback(chunk, result.status);
         }
-        else if (type == STATUS)
+        else
         {
-            QString status = QString::number(m_response->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
-            return status;
+            result.body = m_response->readAll();
+            *bytesReceived += result.body.size();
         }
+        result.headers = m_response->rawHeaderPairs();
+
+        m_response->deleteLater();
+
+        if(m_metrics && !control)
+            m_metrics->record(verb, url, result.status, result.error != QNetworkReply::NoError,
+                              elapsed.nsecsElapsed() / 1000, bytesSent, *bytesReceived);
+
+        //Refill the window before handing out the result, callbacks may queue more work
+        m_inFlight.remove(ticket);
+        release(origin);
+        if(control)
+            m_probes--;
+        schedule();
+        updateBackpressure();
+
+        if(callback)
+            callback(result);
+    });
+}
+
+QString mqhttp::origin(const QString &url)
+{
+    //Plain string scan, QUrl parsing is too slow for every request
+    const int scheme = url.indexOf("://");
+    if(scheme < 0)
+        return QString();
+
+    const int path = url.indexOf('/', scheme + 3);
+    return path < 0 ? url : url.left(path);
+}
+
+quint64 mqhttp::addNodeResolver(const QStringList &origins, mq_nodeResolver resolver)
+{
+    const quint64 id = ++m_nextResolver;
+    for(const QString &node : origins)
+        m_resolvers.insert(node, qMakePair(id, resolver));
+    return id;
+}
+
+void mqhttp::removeNodeResolver(quint64 id)
+{
+    for(auto it = m_resolvers.begin(); it != m_resolvers.end();)
+    {
+        if(it->first == id)
+            it = m_resolvers.erase(it);
         else
-            return QString::fromLatin1(response);
+            ++it;
     }
-    else
+}
+
+void mqhttp::release(const QString &origin)
+{
+    auto it = m_outstanding.find(origin);
+    if(it == m_outstanding.end())
+        return;
+
+    if(--it.value() <= 0)
+        m_outstanding.erase(it);
+}
+
+void mqhttp::updateBackpressure()
+{
+    const bool full = m_maxQueued > 0 && queuedCount() >= m_maxQueued;
+
+    if(full && !m_queueFull)
+    {
+        m_queueFull = true;
+        emit queueFull();
+    }
+    else if(!full && m_queueFull)
+    {
+        m_queueFull = false;
+        emit queueAvailable();
+    }
+}
+
+void mqhttp::cancelled(mq_callback callback, const QString &reason)
+{
+    if(!callback)
+        return;
+
+    mq_reply result;
+    result.status = 0;
+    result.error = QNetworkReply::OperationCanceledError;
+    result.errorString = reason;
+
+    //Keep callbacks asynchronous, callers never see them inside request()
+    QTimer::singleShot(0, this, [callback, result]()
+    {
+        callback(result);
+    });
+}
+
+QVariant mqhttp::get(QString url, QList<mq_httpHeader> headers, responseType type)
+{
+    return toVariant(exec(url, headers, "GET"), type);
+}
+
+QVariant mqhttp::post(QString url, QList<mq_httpHeader> headers, QJsonDocument body, responseType type)
+{
+    return toVariant(exec(url, withJsonContentType(headers), "POST", body.toJson(QJsonDocument::Compact)), type);
+}
+
+QVariant mqhttp::put(QString url, QList<mq_httpHeader> headers, QJsonDocument body, responseType type)
+{
+    return toVariant(exec(url, withJsonContentType(headers), "PUT", body.toJson(QJsonDocument::Compact)), type);
+}
+
+QVariant mqhttp::custom(QString url, QList<mq_httpHeader> headers, QString verb, responseType type)
+{
+    mq_reply reply = exec(url, headers, verb);
+
+    if(reply.error != QNetworkReply::NoError)
     {
-        const QString errorCode = m_response->errorString();
         QJsonObject obj = {
             {"result", "error"},
-            {"desc", QJsonValue(errorCode)}
+            {"desc", QJsonValue(reply.errorString)}
         };
 
         return QJsonDocument(obj);
     }
 
-    return q_response;
+    return toVariant(reply, type);
 }
 
 QVariant mqhttp::custom(QString url, QList<mq_httpHeader> headers, QString verb, QByteArray data, responseType type)
 {
-    QEventLoop q_eventLoop;
-    QVariant q_response;
+    return toVariant(exec(url, headers, verb, data), type);
+}
 
-    QNetworkRequest q_request(url);
-    QNetworkReply *m_response;
+void mqhttp::setRequestCompression(qint64 threshold, int level)
+{
+    m_compressionThreshold = qMax(Q_INT64_C(0), threshold);
+    m_compressionLevel = qBound(1, level, 9);
+}
 
-    q_request.setSslConfiguration(*sslConf);
-    connect(m_manager, SIGNAL(finished(QNetworkReply*)), &q_eventLoop, SLOT(quit()));
+bool mqhttp::isCompressible(const QByteArray &contentType)
+{
+    //Drop parameters, ex. "application/json; charset=utf-8"
+    const QByteArray type = contentType.split(';').first().trimmed().toLower();
+
+    return type.startsWith("text/")
+            || type == "application/json"
+            || type == "application/javascript"
+            || type == "application/xml"
+            || type.endsWith("+json")
+            || type.endsWith("+xml");
+}
+
+void mqhttp::compressBody(mq_pendingRequest &pending)
+{
+    if(m_compressionThreshold <= 0 || pending.verb == "GET" || pending.verb == "HEAD")
+        return;
 
-    for(auto header : headers)
+    QByteArray contentType;
+    for(const mq_httpHeader &header : pending.headers)
     {
-        q_request.setRawHeader(QByteArray::fromStdString(header.key.toStdString().c_str()),
-                               QByteArray::fromStdString(header.value.toStdString().c_str()));
+        //Caller already encoded the body
+        if(header.key.compare("Content-Encoding", Qt::CaseInsensitive) == 0)
+            return;
+        if(header.key.compare("Content-Type", Qt::CaseInsensitive) == 0)
+            contentType = header.value.toLatin1();
     }
 
-    m_response = m_manager->sendCustomRequest(q_request, verb.toStdString().c_str(), data);
-    q_eventLoop.exec();
+    if(!isCompressible(contentType))
+        return;
 
-    if(m_response->error() == QNetworkReply::NoError)
+    if(pending.device)
     {
-        QByteArray response = m_response->readAll();
+        //Sequential devices can not be rewound when the read comes up short
+        if(pending.device->isSequential())
+            return;
 
-        if(type == JSON)
-        {
-            QJsonDocument doc = QJsonDocument::fromJson(response);
-            return doc;
-        }
-        else if (type == STATUS)
+        const qint64 size = pending.deviceSize >= 0 ? pending.deviceSize : pending.device->size() - pending.device->pos();
+        if(size < m_compressionThreshold || size > COMPRESS_DEVICE_LIMIT)
+            return;
+
+        const qint64 position = pending.device->pos();
+        const QByteArray data = pending.device->read(size);
+        if(data.size() != size)
         {
-            QString status = QString::number(m_response->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
-            return status;
+            pending.device->seek(position);
+            return;
         }
-        else
-            return QString::fromLatin1(response);
+
+        pending.data = data;
+        pending.device = nullptr;
+        pending.deviceSize = -1;
     }
-    else
+    else if(pending.data.size() < m_compressionThreshold)
+        return;
+
+    const QByteArray compressed = gzip(pending.data, m_compressionLevel);
+    if(compressed.isEmpty() || compressed.size() >= pending.data.size())
+        return;
+
+    pending.data = compressed;
+    pending.headers.append(mq_httpHeader{ .key = "Content-Encoding", .value = "gzip" });
+}
+
+QByteArray mqhttp::gzip(const QByteArray &data, int level)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    //Window bits 15 + 16 writes a gzip header and trailer instead of zlib's
+    if(deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return QByteArray();
+
+    QByteArray compressed;
+    compressed.resize(int(deflateBound(&stream, uLong(data.size()))));
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    stream.avail_in = uInt(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(compressed.data());
+    stream.avail_out = uInt(compressed.size());
+
+    const int status = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+
+    if(status != Z_STREAM_END)
+        return QByteArray();
+
+    compressed.resize(int(stream.total_out));
+    return compressed;
+}
+
+bool mqhttp::isSuccess(QNetworkReply *reply)
+{
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    return status >= 200 && status < 300;
+}
+
+QNetworkRequest mqhttp::buildRequest(const QString &url, const QList<mq_httpHeader> &headers, const QSslConfiguration &ssl)
+{
+    QNetworkRequest q_request(url);
+    q_request.setSslConfiguration(ssl);
+
+    for(const mq_httpHeader &header : headers)
+        q_request.setRawHeader(header.key.toUtf8(), header.value.toUtf8());
+
+    return q_request;
+}
+
+QNetworkReply *mqhttp::dispatch(const QNetworkRequest &q_request, const QString &verb, const QByteArray &data)
+{
+    if(verb == "GET")
+        return m_manager->get(q_request);
+    else if(verb == "HEAD")
+        return m_manager->head(q_request);
+    else if(verb == "POST")
+        return m_manager->post(q_request, data);
+    else if(verb == "PUT")
+        return m_manager->put(q_request, data);
+    else if(verb == "DELETE" && data.isEmpty())
+        return m_manager->deleteResource(q_request);
+
+    return m_manager->sendCustomRequest(q_request, verb.toLatin1(), data);
+}
+
+QNetworkRequest mqhttp::buildUploadRequest(const QString &url, const QList<mq_httpHeader> &headers, QIODevice *device, qint64 size)
+{
+    QNetworkRequest q_request = buildRequest(url, headers, *sslConf);
+
+    if(size < 0 && !device->isSequential())
+        size = device->size() - device->pos();
+
+    //With a known length Qt reads the device in small blocks instead of buffering all of it first
+    if(size >= 0)
     {
-        const QString errorCode = m_response->errorString();
-        return errorCode;
+        q_request.setHeader(QNetworkRequest::ContentLengthHeader, size);
+        q_request.setAttribute(QNetworkRequest::DoNotBufferUploadDataAttribute, true);
     }
 
-    return q_response;
+    return q_request;
+}
+
+QNetworkReply *mqhttp::dispatch(const QNetworkRequest &q_request, const QString &verb, QIODevice *device)
+{
+    if(verb == "POST")
+        return m_manager->post(q_request, device);
+    else if(verb == "PUT")
+        return m_manager->put(q_request, device);
+
+    return m_manager->sendCustomRequest(q_request, verb.toLatin1(), device);
+}
+
+QList<mq_httpHeader> mqhttp::withJsonContentType(QList<mq_httpHeader> headers)
+{
+    for(const mq_httpHeader &t_header : headers)
+    {
+        if(t_header.key == "Content-Type")
+            return headers;
+    }
+
+    headers.append(mq_httpHeader{ .key = "Content-Type", .value = "application/json"});
+    return headers;
+}
+
+QVariant mqhttp::toVariant(const mq_reply &reply, responseType type)
+{
+    if(reply.error != QNetworkReply::NoError)
+        return reply.errorString;
+
+    if(type == JSON)
+        return QJsonDocument::fromJson(reply.body);
+    else if(type == STATUS)
+        return QString::number(reply.status);
+    else
+        return QString::fromLatin1(reply.body);
 }
 
 void mqhttp::handleSslErrors(QNetworkReply *reply, QList<QSslError> errors)
@@ -14,9 +14,15 @@
 #include <QUrl>
 #include <QString>
 #include <QList>
+#include <QStringList>
+#include <QPair>
 #include <QByteArray>
 #include <QEventLoop>
+#include <QHash>
+#include <QQueue>
+#include <QTimer>
 #include <QDebug>
+#include <QElapsedTimer>
 
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -24,6 +30,12 @@
 #include <QJsonValue>
 #include <QJsonParseError>
 
+#include <functional>
+#include <memory>
+#include <random>
+
+#include "mqmetrics.h"
+
 typedef struct mq_httpHeader{
     QString key;
     QString value;
@@ -34,6 +46,40 @@ typedef struct mq_response{
     QVariant error;
 } mq_response;
 
+typedef struct mq_reply{
+    int status;
+    QNetworkReply::NetworkError error;
+    QString errorString;
+    QByteArray body;
+    QList<QNetworkReply::RawHeaderPair> headers;
+} mq_reply;
+
+//Completion handler of an asynchronous request, called on the mqhttp thread
+typedef std::function<void(const mq_reply &)> mq_callback;
+//Body chunk handler of a streamed request, called with the status as bytes of a 2xx response arrive
+typedef std::function<void(const QByteArray &, int)> mq_dataCallback;
+//Gets the url of a failed attempt, returns the url of the next attempt, ex. the same path on another node
+typedef std::function<QString(const QString &)> mq_nodeResolver;
+
+/**
+ * @brief Url of one document, built in a single allocation
+ * @param node server url without a trailing slash
+ * @param query query string without the leading '?', empty for none
+ * @return node/database/id?query
+ */
+QString mq_documentUrl(const QString &node, const QString &database, const QString &id, const QString &query = QString());
+
+/// @return value of a response header (case-insensitive), empty when it is missing
+inline QByteArray mq_replyHeader(const mq_reply &reply, const QByteArray &name)
+{
+    for(const QNetworkReply::RawHeaderPair &pair : reply.headers)
+    {
+        if(qstricmp(pair.first.constData(), name.constData()) == 0)
+            return pair.second;
+    }
+    return QByteArray();
+}
+
 enum responseType{
     JSON = 0,
     HTML = 1,
@@ -41,6 +87,26 @@ enum responseType{
     STATUS = 3
 };
 
+/**
+ * @brief Retries of failed requests, delays grow as baseDelay * 2^attempt with full jitter
+ * @note GET, HEAD and read-only POSTs (_all_docs, _bulk_get, _find, views) are retried on 5xx, 429 and
+ *       network errors. Other writes are only retried when the connection was refused before sending
+ */
+typedef struct mq_retryPolicy{
+    //Extra attempts, 0 disables retries
+    int maxRetries = 0;
+    //Milliseconds
+    int baseDelay = 100;
+    int maxDelay = 5000;
+} mq_retryPolicy;
+
+//Queued requests are started from the highest priority queue first, FIFO inside a queue
+enum requestPriority{
+    PRIORITY_LOW = 0,
+    PRIORITY_NORMAL = 1,
+    PRIORITY_HIGH = 2
+};
+
 class mqhttp : public QObject
 {
     Q_OBJECT
@@ -52,13 +118,233 @@ public:
     QVariant put(QString url, QList<mq_httpHeader> headers, QJsonDocument body, responseType type);
     QVariant custom(QString url, QList<mq_httpHeader> headers, QString verb, responseType type);
     QVariant custom(QString url, QList<mq_httpHeader> headers, QString verb, QByteArray data, responseType type);
+
+    /**
+     * @brief Start a request without blocking, the reply is delivered to callback
+     * @param url full request url
+     * @param headers raw request headers
+     * @param verb http method, GET/HEAD/POST/PUT/DELETE or any custom verb
+     * @param data request body, may be empty
+     * @param callback called once with status, headers and body when the reply finishes
+     * @param priority position in the scheduler queue when the in-flight window is full
+     * @param deadline milliseconds until the request fails with TimeoutError, retries included.
+     *        -1 uses setDeadline(), 0 waits forever
+     * @return ticket of the request for abort(), 0 when it is rejected because the queue is full
+     * @note rejected and aborted requests still get their callback with OperationCanceledError
+     */
+    quint64 request(QString url, QList<mq_httpHeader> headers, QString verb, QByteArray data, mq_callback callback,
+                    requestPriority priority = PRIORITY_NORMAL, int deadline = -1);
+
+    /**
+     * @brief Start a request whose successful response body is delivered in chunks while it downloads
+     * @param dataCallback receives body chunks of a 2xx response, they are not kept in mq_reply::body
+     * @param callback called once at the end with status and headers, body is only set for failed responses
+     * @return ticket of the request for abort(), 0 when it is rejected because the queue is full
+     */
+    quint64 stream(QString url, QList<mq_httpHeader> headers, QString verb, QByteArray data,
+                   mq_dataCallback dataCallback, mq_callback callback, requestPriority priority = PRIORITY_NORMAL,
+                   int deadline = -1);
+
+    /**
+     * @brief Start a request whose body is read from a device while it is sent
+     * @param device open for reading, it must stay valid until callback is called
+     * @param size body length, -1 takes the remaining size of a random-access device.
+     *        Sequential devices without a size are buffered in memory by Qt before sending
+     * @param callback called once with status, headers and body when the reply finishes
+     * @return ticket of the request for abort() and uploadProgress(), 0 when it is rejected
+     */
+    quint64 upload(QString url, QList<mq_httpHeader> headers, QString verb, QIODevice *device, qint64 size,
+                   mq_callback callback, requestPriority priority = PRIORITY_NORMAL, int deadline = -1);
+
+    /**
+     * @brief Blocking variant of request(), waits only for its own reply
+     * @return typed result with status, headers and body
+     */
+    mq_reply exec(QString url, QList<mq_httpHeader> headers, QString verb, QByteArray data = QByteArray(),
+                  requestPriority priority = PRIORITY_NORMAL, int deadline = -1);
+
+    /**
+     * @brief Cancel a queued or running request
+     * @param ticket returned from request()
+     * @return false when the request is already finished
+     */
+    bool abort(quint64 ticket);
+
+    /// @brief Maximum requests on the wire at once, QNetworkAccessManager opens 6 connections per host
+    void setMaxInFlight(int limit);
+    int maxInFlight() const { return m_maxInFlight; }
+
+    /// @brief Maximum waiting requests, 0 is unbounded. New requests are rejected while it is full
+    void setMaxQueued(int limit);
+    int maxQueued() const { return m_maxQueued; }
+
+    int inFlightCount() const { return m_inFlight.count(); }
+    int queuedCount() const;
+
+    /// @return queued and in-flight requests to scheme://host:port of url, used to balance cluster nodes
+    int outstanding(const QString &url) const { return m_outstanding.value(origin(url)); }
+    /// @return scheme://host:port part of url
+    static QString origin(const QString &url);
+
+    /// @return request for url with headers set as raw UTF-8 pairs and the given SSL configuration
+    static QNetworkRequest buildRequest(const QString &url, const QList<mq_httpHeader> &headers,
+                                        const QSslConfiguration &ssl = QSslConfiguration::defaultConfiguration());
+
+    /**
+     * @brief Send large request bodies gzip encoded with Content-Encoding: gzip
+     * @param threshold minimum body size in bytes, 0 disables compression (default)
+     * @param level zlib level, 1 is fastest and 9 is smallest
+     * @note only bodies with a compressible Content-Type (JSON, text, XML) are encoded.
+     *       Device uploads are compressed when they are random-access and below 16 MB,
+     *       larger ones stream uncompressed. Responses are negotiated with Accept-Encoding
+     *       and decompressed incrementally by QNetworkAccessManager, do not set that header
+     */
+    void setRequestCompression(qint64 threshold, int level = 6);
+    qint64 compressionThreshold() const { return m_compressionThreshold; }
+    int compressionLevel() const { return m_compressionLevel; }
+
+    /**
+     * @brief Record every finished request in metrics, nullptr (default) turns recording off
+     * @note metrics is not owned, it may be shared between clients
+     */
+    void setMetrics(mqmetrics *metrics) { m_metrics = metrics; }
+    mqmetrics *metrics() const { return m_metrics; }
+
+    /**
+     * @brief Send a GET right away, for health checks
+     * @param timeout milliseconds before the request is aborted with OperationCanceledError
+     * @note it skips the queue and in-flight window and is never retried, hedged or recorded in metrics
+     */
+    quint64 probe(QString url, QList<mq_httpHeader> headers, mq_callback callback, int timeout);
+
+    /**
+     * @brief Rewrite the url of retries to some origins, a cluster moves retries off a failing node
+     * @param origins scheme://host:port of the nodes, an origin registered before goes to this resolver
+     * @return id for removeNodeResolver
+     */
+    quint64 addNodeResolver(const QStringList &origins, mq_nodeResolver resolver);
+    /// @brief Drop the origins still held by the resolver of id, origins taken over since stay
+    void removeNodeResolver(quint64 id);
+
+    /// @brief Retry transient failures with jittered exponential backoff, off by default
+    void setRetryPolicy(mq_retryPolicy policy) { m_retryPolicy = policy; }
+    mq_retryPolicy retryPolicy() const { return m_retryPolicy; }
+
+    /// @brief Default deadline of every request in milliseconds, 0 (default) waits forever
+    void setDeadline(int deadline) { m_deadline = qMax(0, deadline); }
+    int deadline() const { return m_deadline; }
+
+    /**
+     * @brief Send a second copy of slow GET/HEAD requests and take the reply that arrives first
+     * @param fallbackDelay milliseconds before the copy is sent. With setMetrics() the p95 latency
+     *        of the same operation is used once it has samples
+     * @note streamed requests are not hedged, their chunks can not be taken from two replies
+     */
+    void setHedging(bool enabled, int fallbackDelay = 50);
+    bool hedging() const { return m_hedging; }
+
+    /// @return true for Content-Types worth compressing, ex. application/json or text/plain
+    static bool isCompressible(const QByteArray &contentType);
 signals:
+    /// Queue reached maxQueued, following requests are rejected until queueAvailable()
+    void queueFull();
+    /// Queue has room again after queueFull()
+    void queueAvailable();
+    /// Bytes sent of a request started with upload()
+    void uploadProgress(quint64 ticket, qint64 bytesSent, qint64 bytesTotal);
 
 public slots:
     void handleSslErrors(QNetworkReply *reply, QList<QSslError> errors);
 private:
+    typedef struct mq_pendingRequest{
+        quint64 ticket;
+        QString url;
+        QList<mq_httpHeader> headers;
+        QString verb;
+        QByteArray data;
+        QIODevice *device = nullptr;
+        qint64 deviceSize = -1;
+        mq_dataCallback dataCallback;
+        mq_callback callback;
+        QString origin;
+        //compressBody() already ran, attempts of one request share the encoded body
+        bool compressed = false;
+        //Health check started by probe(), kept out of metrics and outstanding counts
+        bool control = false;
+        //Sent by upload(), reports uploadProgress even after compressBody() read the device into data
+        bool upload = false;
+    } mq_pendingRequest;
+
+    //One call of request()/stream()/upload() with its attempts, used when retries, deadlines or hedging are on
+    typedef struct mq_requestState{
+        mq_pendingRequest pending;
+        requestPriority priority;
+        quint64 ticket = 0;
+        int attempt = 0;
+        bool retryable = false;
+        bool hedge = false;
+        bool hedged = false;
+        bool done = false;
+        //Chunks were handed to the caller, a new attempt would repeat them
+        bool delivered = false;
+        QList<quint64> running;
+    } mq_requestState;
+
+    quint64 startRequest(mq_pendingRequest &pending, requestPriority priority, int deadline);
+    quint64 launch(std::shared_ptr<mq_requestState> state);
+    void attemptFinished(std::shared_ptr<mq_requestState> state, quint64 ticket, const mq_reply &reply);
+    void finishRequest(std::shared_ptr<mq_requestState> state, const mq_reply &reply);
+    bool shouldRetry(const mq_requestState &state, const mq_reply &reply) const;
+    int hedgeDelay(const mq_pendingRequest &pending) const;
+    static bool isIdempotent(const QString &verb, const QString &url);
+    bool abortTicket(quint64 ticket);
+
+    quint64 enqueue(mq_pendingRequest &pending, requestPriority priority);
+    void schedule();
+    void start(const mq_pendingRequest &pending);
+    void updateBackpressure();
+    void cancelled(mq_callback callback, const QString &reason);
+    static bool isSuccess(QNetworkReply *reply);
+    void compressBody(mq_pendingRequest &pending);
+    static QByteArray gzip(const QByteArray &data, int level);
+
+    QNetworkRequest buildUploadRequest(const QString &url, const QList<mq_httpHeader> &headers, QIODevice *device, qint64 size);
+    QNetworkReply *dispatch(const QNetworkRequest &q_request, const QString &verb, const QByteArray &data);
+    QNetworkReply *dispatch(const QNetworkRequest &q_request, const QString &verb, QIODevice *device);
+    static QList<mq_httpHeader> withJsonContentType(QList<mq_httpHeader> headers);
+    static QVariant toVariant(const mq_reply &reply, responseType type);
+
     QNetworkAccessManager *m_manager;
     QSslConfiguration *sslConf;
+
+    //Scheduler state, one FIFO per requestPriority
+    QQueue<mq_pendingRequest> m_queues[PRIORITY_HIGH + 1];
+    QHash<quint64, QNetworkReply*> m_inFlight;
+    //Queued and in-flight requests by origin
+    QHash<QString, int> m_outstanding;
+    void release(const QString &origin);
+    quint64 m_lastTicket = 0;
+    int m_maxInFlight = 6;
+    int m_maxQueued = 0;
+    bool m_queueFull = false;
+
+    qint64 m_compressionThreshold = 0;
+    int m_compressionLevel = 6;
+
+    mqmetrics *m_metrics = nullptr;
+
+    mq_retryPolicy m_retryPolicy;
+    int m_deadline = 0;
+    bool m_hedging = false;
+    int m_hedgeDelay = 50;
+    //Requests with attempts by the ticket returned to the caller
+    QHash<quint64, std::shared_ptr<mq_requestState>> m_requests;
+    //Resolver id and resolver by origin of the retried url
+    QHash<QString, QPair<quint64, mq_nodeResolver>> m_resolvers;
+    quint64 m_nextResolver = 0;
+    //Requests of probe() in m_inFlight, they do not take window slots
+    int m_probes = 0;
+    std::mt19937 m_random;
 };
 
 #endif // MQHTTP_H
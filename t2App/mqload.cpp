@@ -0,0 +1,326 @@
+/**
+ *  @file    mqload.cpp
+ *
+ *  @brief Load generator
+ *
+ *  @section DESCRIPTION
+ *
+ *  Closed loop YCSB style workloads against a CouchDB url, reports
+ *  throughput and latency percentiles per operation
+ */
+
+#include "mqload.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QJsonArray>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+static const char *OPERATION_NAMES[] = { "read", "update", "insert", "remove", "scan" };
+
+mqload::mqload(_mq_loadOptions options)
+{
+    m_options = options;
+    m_options.records = qMax(1, m_options.records);
+    m_options.sizeMax = qMax(m_options.sizeMin, m_options.sizeMax);
+
+    //Gray et al. "Quickly generating billion-record synthetic databases", as used by YCSB
+    for(int i = 1; i <= m_options.records; i++)
+        m_zetan += 1.0 / std::pow(double(i), m_theta);
+
+    const double zeta2 = 1.0 + 1.0 / std::pow(2.0, m_theta);
+    m_alpha = 1.0 / (1.0 - m_theta);
+
+    //With one or two records zetan equals zeta2 at most, nextRank never reaches m_eta
+    if(m_options.records > 2)
+        m_eta = (1.0 - std::pow(2.0 / m_options.records, 1.0 - m_theta)) / (1.0 - zeta2 / m_zetan);
+}
+
+bool mqload::workloadMix(const QString &name, double *mix)
+{
+    //read, update, insert, remove, scan
+    static const QHash<QString, QVector<double>> workloads = {
+        { "a", { 0.5, 0.5, 0, 0, 0 } },
+        { "b", { 0.95, 0.05, 0, 0, 0 } },
+        { "c", { 1, 0, 0, 0, 0 } },
+        { "d", { 0.95, 0, 0.05, 0, 0 } },
+        { "e", { 0, 0, 0.05, 0, 0.95 } },
+        { "w", { 0, 0, 0.5, 0.5, 0 } }
+    };
+
+    const QString workload = name.toLower();
+    if(!workloads.contains(workload))
+        return false;
+
+    const QVector<double> weights = workloads.value(workload);
+    for(int i = 0; i <= LOAD_SCAN; i++)
+        mix[i] = weights.at(i);
+
+    return true;
+}
+
+QJsonDocument mqload::run()
+{
+    mqpool pool(m_options.url.split(",", QString::SkipEmptyParts), m_options.concurrency);
+    pool.forEach([](mqcouch *couch) { couch->setConflictRetries(3); });
+
+    if(m_options.load)
+        loadRecords(pool);
+
+    {
+        QMutexLocker locker(&m_keysMutex);
+        m_liveKeys.clear();
+        for(int i = 0; i < m_options.records; i++)
+            m_liveKeys.push_back(quint64(i));
+        m_nextKey = quint64(m_options.records);
+    }
+    m_metrics.reset();
+    pool.setMetrics(&m_metrics);
+
+    QElapsedTimer clock;
+    clock.start();
+    const qint64 deadline = QDateTime::currentMSecsSinceEpoch() + qint64(m_options.duration) * 1000;
+
+    //One closed loop per worker thread
+    std::vector<std::future<mq_loadWorker>> workers;
+    for(int i = 0; i < pool.workerCount(); i++)
+    {
+        const quint32 seed = m_options.seed + quint32(i);
+        workers.push_back(pool.submit([this, seed, deadline](mqcouch *couch) { return runWorker(couch, seed, deadline); }));
+    }
+
+    _mq_loadResult totals[LOAD_SCAN + 1];
+    for(std::future<mq_loadWorker> &worker : workers)
+    {
+        const mq_loadWorker result = worker.get();
+        for(int op = 0; op <= LOAD_SCAN; op++)
+        {
+            totals[op].count += result.results[op].count;
+            totals[op].errors += result.results[op].errors;
+            totals[op].latencies += result.results[op].latencies;
+        }
+    }
+
+    const double seconds = clock.nsecsElapsed() / 1e9;
+    pool.setMetrics(nullptr);
+
+    quint64 count = 0;
+    QJsonObject operations;
+    for(int op = 0; op <= LOAD_SCAN; op++)
+    {
+        count += totals[op].count;
+        if(totals[op].count)
+            operations.insert(OPERATION_NAMES[op], summarize(totals[op], seconds));
+    }
+
+    return QJsonDocument(QJsonObject{
+        {"url", m_options.url},
+        {"database", m_options.database},
+        {"concurrency", pool.workerCount()},
+        {"seconds", seconds},
+        {"operations", double(count)},
+        {"throughput", count / seconds},
+        {"byOperation", operations}
+    });
+}
+
+void mqload::loadRecords(mqpool &pool)
+{
+    const QString database = m_options.database;
+    pool.submit([database](mqcouch *couch)
+    {
+        couch->removeDatabase(database);
+        couch->createDatabase(database);
+    }).wait();
+
+    //Batches of _bulk_docs spread over the workers
+    const int batch = 1000;
+    std::vector<std::future<void>> loads;
+    for(int first = 0; first < m_options.records; first += batch)
+    {
+        const int last = qMin(first + batch, m_options.records);
+        loads.push_back(pool.submit([this, database, first, last](mqcouch *couch)
+        {
+            std::mt19937 random(m_options.seed + quint32(first));
+
+            QList<QByteArray> documents;
+            for(int i = first; i < last; i++)
+                documents << makeBody(key(quint64(i)), random);
+
+            couch->addDocuments(database, documents);
+        }));
+    }
+
+    for(std::future<void> &load : loads)
+        load.wait();
+}
+
+mqload::mq_loadWorker mqload::runWorker(mqcouch *couch, quint32 seed, qint64 deadline)
+{
+    mq_loadWorker worker;
+    std::mt19937 random(seed);
+    std::discrete_distribution<int> pick(std::begin(m_options.mix), std::end(m_options.mix));
+    QElapsedTimer timer;
+
+    while(QDateTime::currentMSecsSinceEpoch() < deadline)
+    {
+        const int op = pick(random);
+        bool ok = false;
+        quint64 index = 0;
+
+        //Nothing left to read or remove, draw another operation
+        if((op == LOAD_READ || op == LOAD_UPDATE || op == LOAD_SCAN) && NOT pickKey(random, &index))
+            continue;
+        if(op == LOAD_REMOVE && NOT takeOldestKey(&index))
+            continue;
+
+        timer.start();
+        switch(op)
+        {
+        case LOAD_READ:
+            ok = NOT couch->getDocument(m_options.database, key(index)).id.isEmpty();
+            break;
+        case LOAD_UPDATE:
+        {
+            const QString id = key(index);
+            ok = couch->updateDocument(m_options.database, makeBody(id, random), id).ok;
+            break;
+        }
+        case LOAD_INSERT:
+            index = reserveKey();
+            ok = couch->addDocument(m_options.database, makeBody(key(index), random)).ok;
+            //Readable only once it exists
+            if(ok)
+                addLiveKey(index);
+            break;
+        case LOAD_REMOVE:
+            ok = couch->removeDocument(m_options.database, key(index));
+            break;
+        case LOAD_SCAN:
+            //Short range from a key of the request distribution, as workload E
+            ok = NOT couch->getDocumentList(m_options.database, m_options.scanLength, false, key(index)).isEmpty();
+            break;
+        }
+
+        _mq_loadResult &result = worker.results[op];
+        result.count++;
+        result.errors += ok ? 0 : 1;
+        result.latencies.append(timer.nsecsElapsed() / 1000);
+    }
+
+    return worker;
+}
+
+QString mqload::key(quint64 index) const
+{
+    return "user" + QString::number(index).rightJustified(10, '0');
+}
+
+QByteArray mqload::makeBody(const QString &id, std::mt19937 &random) const
+{
+    const int size = std::uniform_int_distribution<int>(m_options.sizeMin, m_options.sizeMax)(random);
+    const char letter = char('a' + random() % 26);
+
+    return QJsonDocument(QJsonObject{ {"_id", id}, {"field0", QString(size, QChar(letter))} }).toJson(QJsonDocument::Compact);
+}
+
+bool mqload::pickKey(std::mt19937 &random, quint64 *index)
+{
+    //Drawn outside the lock, only the position is taken under it
+    const quint64 rank = m_options.keys == DISTRIBUTION_UNIFORM ? quint64(random()) : nextRank(random);
+
+    QMutexLocker locker(&m_keysMutex);
+    const quint64 items = quint64(m_liveKeys.size());
+    if(items == 0)
+        return false;
+
+    if(m_options.keys == DISTRIBUTION_LATEST)
+    {
+        *index = m_liveKeys[items - 1 - rank % items];
+        return true;
+    }
+
+    if(m_options.keys == DISTRIBUTION_UNIFORM)
+    {
+        *index = m_liveKeys[rank % items];
+        return true;
+    }
+
+    //Scramble with FNV-1a so hot keys are spread over the key space
+    quint64 hash = 14695981039346656037ULL;
+    for(int i = 0; i < 8; i++)
+    {
+        hash ^= (rank >> (i * 8)) & 0xff;
+        hash *= 1099511628211ULL;
+    }
+
+    *index = m_liveKeys[hash % items];
+    return true;
+}
+
+bool mqload::takeOldestKey(quint64 *index)
+{
+    //Removed before the request, reads never pick a key that is going away
+    QMutexLocker locker(&m_keysMutex);
+    if(m_liveKeys.empty())
+        return false;
+
+    *index = m_liveKeys.front();
+    m_liveKeys.pop_front();
+    return true;
+}
+
+quint64 mqload::reserveKey()
+{
+    QMutexLocker locker(&m_keysMutex);
+    return m_nextKey++;
+}
+
+void mqload::addLiveKey(quint64 index)
+{
+    QMutexLocker locker(&m_keysMutex);
+    m_liveKeys.push_back(index);
+}
+
+quint64 mqload::nextRank(std::mt19937 &random) const
+{
+    const quint64 items = quint64(m_options.records);
+
+    const double u = std::uniform_real_distribution<double>(0, 1)(random);
+    const double uz = u * m_zetan;
+
+    quint64 rank;
+    if(uz < 1.0)
+        rank = 0;
+    else if(uz < 1.0 + std::pow(0.5, m_theta))
+        rank = 1;
+    else
+        rank = quint64(items * std::pow(m_eta * u - m_eta + 1.0, m_alpha));
+
+    return rank;
+}
+
+QJsonObject mqload::summarize(_mq_loadResult result, double seconds)
+{
+    std::sort(result.latencies.begin(), result.latencies.end());
+
+    auto percentile = [&result](double quantile)
+    {
+        const int index = qMin(result.latencies.count() - 1, int(std::ceil(quantile * result.latencies.count())) - 1);
+        return result.latencies.at(qMax(0, index)) / 1000.0;
+    };
+
+    return QJsonObject{
+        {"count", double(result.count)},
+        {"errors", double(result.errors)},
+        {"throughput", result.count / seconds},
+        {"p50", percentile(0.5)},
+        {"p95", percentile(0.95)},
+        {"p99", percentile(0.99)},
+        {"p999", percentile(0.999)},
+        {"max", result.latencies.last() / 1000.0}
+    };
+}
@@ -0,0 +1,111 @@
+#ifndef MQLOAD_H
+#define MQLOAD_H
+
+#include "mqpool.h"
+#include "mqmetrics.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <deque>
+#include <random>
+
+enum loadOperation{
+    LOAD_READ = 0,
+    LOAD_UPDATE = 1,
+    LOAD_INSERT = 2,
+    LOAD_REMOVE = 3,
+    LOAD_SCAN = 4
+};
+
+enum loadDistribution{
+    DISTRIBUTION_UNIFORM = 0,
+    DISTRIBUTION_ZIPFIAN = 1,
+    //Zipfian over insertion order, the newest keys are the hottest (YCSB D)
+    DISTRIBUTION_LATEST = 2
+};
+
+typedef struct _mq_loadOptions{
+    QString url = "http://localhost:5984";
+    QString database = "mqload";
+    //Operation mix, weights of loadOperation in order, ex. YCSB A is 50/50/0/0/0
+    double mix[LOAD_SCAN + 1] = { 0.5, 0.5, 0, 0, 0 };
+    int concurrency = 8;
+    int duration = 30;                    //seconds of measured load
+    int records = 10000;                  //documents loaded before the run
+    bool load = true;                     //false reuses documents of a previous run
+    int sizeMin = 1024;                   //document body bytes
+    int sizeMax = 1024;                   //uniformly chosen between min and max
+    loadDistribution keys = DISTRIBUTION_ZIPFIAN;
+    int scanLength = 100;
+    quint32 seed = 1;
+} _mq_loadOptions;
+
+typedef struct _mq_loadResult{
+    quint64 count = 0;
+    quint64 errors = 0;
+    QVector<qint64> latencies;            //microseconds, sorted by report()
+} _mq_loadResult;
+
+/**
+ * @brief YCSB style load generator
+ *
+ * Every pool worker runs a closed loop of operations drawn from the mix
+ * until the duration ends. Reads and updates follow a uniform, scrambled
+ * zipfian or latest distribution over the live keys, inserts add new keys
+ * and removes take the oldest one, bodies have a uniform size.
+ */
+class mqload
+{
+public:
+    explicit mqload(_mq_loadOptions options);
+
+    /// @return false when the YCSB workload name is unknown
+    static bool workloadMix(const QString &name, double *mix);
+
+    /// @brief Load records, run the mix and return the report
+    QJsonDocument run();
+
+    /// @brief Requests of the run by operation, recorded by the pool's clients
+    const mqmetrics &metrics() const { return m_metrics; }
+
+private:
+    typedef struct mq_loadWorker{
+        _mq_loadResult results[LOAD_SCAN + 1];
+    } mq_loadWorker;
+
+    void loadRecords(mqpool &pool);
+    mq_loadWorker runWorker(mqcouch *couch, quint32 seed, qint64 deadline);
+
+    QString key(quint64 index) const;
+    QByteArray makeBody(const QString &id, std::mt19937 &random) const;
+    quint64 nextRank(std::mt19937 &random) const;
+    //Live keys by insertion order, false when there is none
+    bool pickKey(std::mt19937 &random, quint64 *index);
+    bool takeOldestKey(quint64 *index);
+    quint64 reserveKey();
+    void addLiveKey(quint64 index);
+    static QJsonObject summarize(_mq_loadResult result, double seconds);
+
+    _mq_loadOptions m_options;
+    mqmetrics m_metrics;
+
+    //Keys that exist in the database, oldest first, shared by every worker
+    QMutex m_keysMutex;
+    std::deque<quint64> m_liveKeys;
+    quint64 m_nextKey = 0;
+
+    //Zipfian constants over m_options.records, theta 0.99 as in YCSB
+    double m_theta = 0.99;
+    double m_zetan = 0;
+    double m_alpha = 0;
+    double m_eta = 0;
+};
+
+#endif // MQLOAD_H
@@ -0,0 +1,390 @@
+/**
+ *  @file    mqmapping.cpp
+ *
+ *  @brief Struct to JSON mapping
+ *
+ *  @section DESCRIPTION
+ *
+ *  Pull parser and value writers used by the mq_toJson/mq_fromJson templates,
+ *  documents are read and written without QJsonObject intermediates
+ */
+
+#include "mqmapping.h"
+
+#include <cmath>
+
+void mq_writeString(QByteArray &buffer, const QString &value)
+{
+    static const char hex[] = "0123456789abcdef";
+    const QByteArray utf8 = value.toUtf8();
+
+    buffer += '"';
+    for(const char c : utf8)
+    {
+        if(c == '"' || c == '\\')
+        {
+            buffer += '\\';
+            buffer += c;
+        }
+        else if(static_cast<unsigned char>(c) < 0x20)
+        {
+            buffer += "\\u00";
+            buffer += hex[(c >> 4) & 0xf];
+            buffer += hex[c & 0xf];
+        }
+        else
+            buffer += c;
+    }
+    buffer += '"';
+}
+
+void mq_writeValue(QByteArray &buffer, double value)
+{
+    //JSON has no NaN or infinity
+    if(!std::isfinite(value))
+        buffer += "null";
+    else
+        buffer += QByteArray::number(value, 'g', 17);
+}
+
+void mq_writeValue(QByteArray &buffer, const QStringList &value)
+{
+    mq_writeArray(buffer, value);
+}
+
+void mq_writeValue(QByteArray &buffer, const QJsonValue &value)
+{
+    //Free-form parts still go through Qt's serializer
+    const QByteArray array = QJsonDocument(QJsonArray{ value }).toJson(QJsonDocument::Compact);
+    buffer.append(array.constData() + 1, array.size() - 2);
+}
+
+bool mq_readValue(mqjsonreader &reader, int &value)
+{
+    qint64 number;
+    if(!reader.readInteger(&number))
+        return false;
+
+    value = int(number);
+    return true;
+}
+
+bool mq_readValue(mqjsonreader &reader, QStringList &value)
+{
+    return mq_readArray(reader, value);
+}
+
+bool mq_readValue(mqjsonreader &reader, QJsonValue &value)
+{
+    const char *begin, *end;
+    if(!reader.skipValue(&begin, &end))
+        return false;
+
+    QByteArray array = "[";
+    array.append(begin, int(end - begin));
+    array += ']';
+
+    value = QJsonDocument::fromJson(array).array().at(0);
+    return true;
+}
+
+bool mq_readValue(mqjsonreader &reader, QJsonObject &value)
+{
+    QJsonValue json;
+    if(!mq_readValue(reader, json) || !json.isObject())
+        return reader.fail();
+
+    value = json.toObject();
+    return true;
+}
+
+bool mq_readValue(mqjsonreader &reader, QJsonArray &value)
+{
+    QJsonValue json;
+    if(!mq_readValue(reader, json) || !json.isArray())
+        return reader.fail();
+
+    value = json.toArray();
+    return true;
+}
+
+void mqjsonreader::skipWhitespace()
+{
+    while(m_position < m_end && (*m_position == ' ' || *m_position == '\n' || *m_position == '\r' || *m_position == '\t'))
+        m_position++;
+}
+
+bool mqjsonreader::expect(char c)
+{
+    skipWhitespace();
+    if(m_position >= m_end || *m_position != c)
+        return fail();
+
+    m_position++;
+    return true;
+}
+
+bool mqjsonreader::beginObject()
+{
+    return m_ok && expect('{');
+}
+
+bool mqjsonreader::nextKey()
+{
+    skipWhitespace();
+    if(!m_ok || m_position >= m_end)
+        return fail();
+
+    if(*m_position == '}')
+    {
+        m_position++;
+        return false;
+    }
+    if(*m_position == ',')
+    {
+        m_position++;
+        skipWhitespace();
+    }
+
+    if(m_position >= m_end || *m_position != '"')
+        return fail();
+
+    //Key bytes are kept raw, field names never contain escapes
+    const char *begin = m_position + 1;
+    if(!skipString())
+        return false;
+
+    m_key = begin;
+    m_keyLength = int(m_position - 1 - begin);
+
+    return expect(':');
+}
+
+bool mqjsonreader::keyEquals(const char *name) const
+{
+    return qstrlen(name) == uint(m_keyLength) && qstrncmp(name, m_key, uint(m_keyLength)) == 0;
+}
+
+bool mqjsonreader::beginArray()
+{
+    return m_ok && expect('[');
+}
+
+bool mqjsonreader::nextElement()
+{
+    skipWhitespace();
+    if(!m_ok || m_position >= m_end)
+        return fail();
+
+    if(*m_position == ']')
+    {
+        m_position++;
+        return false;
+    }
+    if(*m_position == ',')
+        m_position++;
+
+    return true;
+}
+
+bool mqjsonreader::skipString()
+{
+    //m_position is on the opening quote
+    for(m_position++; m_position < m_end; m_position++)
+    {
+        if(*m_position == '\\')
+            m_position++;
+        else if(*m_position == '"')
+        {
+            m_position++;
+            return true;
+        }
+    }
+
+    return fail();
+}
+
+bool mqjsonreader::readString(QString *value)
+{
+    skipWhitespace();
+    if(!m_ok || m_position >= m_end || *m_position != '"')
+        return fail();
+
+    const char *chunk = ++m_position;
+    QString result;
+
+    while(m_position < m_end && *m_position != '"')
+    {
+        if(*m_position != '\\')
+        {
+            m_position++;
+            continue;
+        }
+
+        //Text before the escape, then the escaped character
+        result += QString::fromUtf8(chunk, int(m_position - chunk));
+        if(++m_position >= m_end)
+            return fail();
+
+        switch(*m_position)
+        {
+        case 'n': result += QChar('\n'); break;
+        case 't': result += QChar('\t'); break;
+        case 'r': result += QChar('\r'); break;
+        case 'b': result += QChar('\b'); break;
+        case 'f': result += QChar('\f'); break;
+        case 'u':
+        {
+            if(m_end - m_position < 5)
+                return fail();
+
+            bool ok;
+            const ushort code = QByteArray(m_position + 1, 4).toUShort(&ok, 16);
+            if(!ok)
+                return fail();
+
+            //Surrogate pairs arrive as two escapes, UTF-16 joins them
+            result += QChar(code);
+            m_position += 4;
+            break;
+        }
+        default:
+            result += QChar(*m_position);
+        }
+
+        chunk = ++m_position;
+    }
+
+    if(m_position >= m_end)
+        return fail();
+
+    //Without escapes this is the only conversion
+    if(result.isEmpty())
+        *value = QString::fromUtf8(chunk, int(m_position - chunk));
+    else
+        *value = result + QString::fromUtf8(chunk, int(m_position - chunk));
+
+    m_position++;
+    return true;
+}
+
+bool mqjsonreader::readDouble(double *value)
+{
+    const char *begin, *end;
+    skipWhitespace();
+    if(m_position >= m_end || (*m_position != '-' && (*m_position < '0' || *m_position > '9')))
+        return fail();
+    if(!skipValue(&begin, &end))
+        return false;
+
+    bool ok;
+    *value = QByteArray::fromRawData(begin, int(end - begin)).toDouble(&ok);
+    return ok || fail();
+}
+
+bool mqjsonreader::readInteger(qint64 *value)
+{
+    const char *begin, *end;
+    skipWhitespace();
+    if(m_position >= m_end || (*m_position != '-' && (*m_position < '0' || *m_position > '9')))
+        return fail();
+    if(!skipValue(&begin, &end))
+        return false;
+
+    //Exact up to 64 bits, values written as 1e3 or 2.0 go through double
+    const QByteArray number = QByteArray::fromRawData(begin, int(end - begin));
+    bool ok;
+    *value = number.toLongLong(&ok);
+    if(!ok)
+        *value = qint64(number.toDouble(&ok));
+
+    return ok || fail();
+}
+
+bool mqjsonreader::readBool(bool *value)
+{
+    skipWhitespace();
+    if(m_end - m_position >= 4 && qstrncmp(m_position, "true", 4) == 0)
+    {
+        *value = true;
+        m_position += 4;
+        return true;
+    }
+    if(m_end - m_position >= 5 && qstrncmp(m_position, "false", 5) == 0)
+    {
+        *value = false;
+        m_position += 5;
+        return true;
+    }
+
+    return fail();
+}
+
+bool mqjsonreader::readNull()
+{
+    skipWhitespace();
+    if(m_end - m_position >= 4 && qstrncmp(m_position, "null", 4) == 0)
+    {
+        m_position += 4;
+        return true;
+    }
+
+    return false;
+}
+
+bool mqjsonreader::skipValue(const char **begin, const char **end)
+{
+    skipWhitespace();
+    if(!m_ok || m_position >= m_end)
+        return fail();
+
+    const char *start = m_position;
+
+    if(*m_position == '"')
+    {
+        if(!skipString())
+            return false;
+    }
+    else if(*m_position == '{' || *m_position == '[')
+    {
+        int depth = 0;
+        for(; m_position < m_end; m_position++)
+        {
+            const char c = *m_position;
+
+            if(c == '"')
+            {
+                if(!skipString())
+                    return false;
+                m_position--;
+            }
+            else if(c == '{' || c == '[')
+                depth++;
+            else if((c == '}' || c == ']') && --depth == 0)
+            {
+                m_position++;
+                break;
+            }
+        }
+
+        if(depth != 0)
+            return fail();
+    }
+    else
+    {
+        //Number, true, false or null
+        while(m_position < m_end && *m_position != ',' && *m_position != '}' && *m_position != ']'
+              && *m_position != ' ' && *m_position != '\n' && *m_position != '\r' && *m_position != '\t')
+            m_position++;
+
+        if(m_position == start)
+            return fail();
+    }
+
+    if(begin)
+        *begin = start;
+    if(end)
+        *end = m_position;
+
+    return true;
+}
@@ -0,0 +1,307 @@
+#ifndef MQMAPPING_H
+#define MQMAPPING_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonValue>
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Compile-time mapping between structs and JSON documents
+ *
+ *   struct album { QString id; QString rev; QString name; int year = 0; QStringList tags; };
+ *   MQ_MAPPING(album, MQ_FIELD_NAMED(album, id, "_id"), MQ_FIELD_NAMED(album, rev, "_rev"),
+ *              MQ_FIELD(album, name), MQ_FIELD(album, year), MQ_FIELD(album, tags))
+ *
+ * mq_toJson() writes members straight into a byte buffer and mq_fromJson() reads
+ * a response straight into members, no QJsonObject is built on the way.
+ * Supported members: QString, bool, int, qint64, double, QStringList, QList/QVector/std::vector
+ * of supported types, other mapped structs and QJsonValue/QJsonObject/QJsonArray for free-form parts.
+ */
+
+/// Field descriptor, name in JSON and pointer to the member
+template<typename Class, typename Member>
+struct mq_field{
+    const char *name;
+    Member Class::*member;
+};
+
+template<typename Class, typename Member>
+constexpr mq_field<Class, Member> mq_makeField(const char *name, Member Class::*member)
+{
+    return mq_field<Class, Member>{ name, member };
+}
+
+#define MQ_FIELD(type, member) mq_makeField(#member, &type::member)
+#define MQ_FIELD_NAMED(type, member, name) mq_makeField(name, &type::member)
+
+/// Specialized by MQ_MAPPING, fields() returns a tuple of mq_field
+template<typename T>
+struct mq_mapping{};
+
+#define MQ_MAPPING(type, ...) \
+    template<> struct mq_mapping<type>{ \
+        static constexpr auto fields() { return std::make_tuple(__VA_ARGS__); } \
+    };
+
+template<typename T, typename = void>
+struct mq_isMapped : std::false_type {};
+
+template<typename T>
+struct mq_isMapped<T, decltype((void)mq_mapping<T>::fields())> : std::true_type {};
+
+/**
+ * @brief Pull parser over JSON bytes, values are decoded in place without a DOM
+ * @note input must stay valid while the reader is used
+ */
+class mqjsonreader
+{
+public:
+    mqjsonreader(const char *begin, const char *end) : m_position(begin), m_end(end) {}
+
+    bool ok() const { return m_ok; }
+    bool fail() { m_ok = false; return false; }
+
+    /// @brief Consume '{', then call nextKey() until it returns false
+    bool beginObject();
+    /// @return false at the end of the object, else the key is read and keyEquals() can be used
+    bool nextKey();
+    bool keyEquals(const char *name) const;
+
+    /// @brief Consume '[', then call nextElement() until it returns false
+    bool beginArray();
+    bool nextElement();
+
+    bool readString(QString *value);
+    bool readDouble(double *value);
+    bool readInteger(qint64 *value);
+    bool readBool(bool *value);
+    /// @return true and consumes the value when it is null
+    bool readNull();
+    /// @brief Skip any value, its bytes are available in [begin, end) when requested
+    bool skipValue(const char **begin = nullptr, const char **end = nullptr);
+
+private:
+    void skipWhitespace();
+    bool expect(char c);
+    bool skipString();
+
+    const char *m_position;
+    const char *m_end;
+    const char *m_key = nullptr;
+    int m_keyLength = 0;
+    bool m_ok = true;
+};
+
+//Writers, they append to the buffer
+void mq_writeString(QByteArray &buffer, const QString &value);
+inline void mq_writeValue(QByteArray &buffer, const QString &value) { mq_writeString(buffer, value); }
+inline void mq_writeValue(QByteArray &buffer, bool value) { buffer += value ? "true" : "false"; }
+inline void mq_writeValue(QByteArray &buffer, int value) { buffer += QByteArray::number(value); }
+inline void mq_writeValue(QByteArray &buffer, qint64 value) { buffer += QByteArray::number(value); }
+void mq_writeValue(QByteArray &buffer, double value);
+void mq_writeValue(QByteArray &buffer, const QStringList &value);
+void mq_writeValue(QByteArray &buffer, const QJsonValue &value);
+inline void mq_writeValue(QByteArray &buffer, const QJsonObject &value) { mq_writeValue(buffer, QJsonValue(value)); }
+inline void mq_writeValue(QByteArray &buffer, const QJsonArray &value) { mq_writeValue(buffer, QJsonValue(value)); }
+template<typename T> void mq_writeValue(QByteArray &buffer, const QList<T> &value);
+template<typename T> void mq_writeValue(QByteArray &buffer, const QVector<T> &value);
+template<typename T> void mq_writeValue(QByteArray &buffer, const std::vector<T> &value);
+template<typename T> typename std::enable_if<mq_isMapped<T>::value>::type mq_writeValue(QByteArray &buffer, const T &value);
+
+//Readers, null keeps the member as it is
+inline bool mq_readValue(mqjsonreader &reader, QString &value) { return reader.readString(&value); }
+inline bool mq_readValue(mqjsonreader &reader, bool &value) { return reader.readBool(&value); }
+inline bool mq_readValue(mqjsonreader &reader, double &value) { return reader.readDouble(&value); }
+inline bool mq_readValue(mqjsonreader &reader, qint64 &value) { return reader.readInteger(&value); }
+bool mq_readValue(mqjsonreader &reader, int &value);
+bool mq_readValue(mqjsonreader &reader, QStringList &value);
+bool mq_readValue(mqjsonreader &reader, QJsonValue &value);
+bool mq_readValue(mqjsonreader &reader, QJsonObject &value);
+bool mq_readValue(mqjsonreader &reader, QJsonArray &value);
+template<typename T> bool mq_readValue(mqjsonreader &reader, QList<T> &value);
+template<typename T> bool mq_readValue(mqjsonreader &reader, QVector<T> &value);
+template<typename T> bool mq_readValue(mqjsonreader &reader, std::vector<T> &value);
+template<typename T> typename std::enable_if<mq_isMapped<T>::value, bool>::type mq_readValue(mqjsonreader &reader, T &value);
+
+//Empty _id/_rev are left out, new documents get them from the server
+template<typename Member>
+inline bool mq_isOmitted(const char *, const Member &) { return false; }
+inline bool mq_isOmitted(const char *name, const QString &value) { return name[0] == '_' && value.isEmpty(); }
+
+template<typename Container>
+void mq_writeArray(QByteArray &buffer, const Container &value)
+{
+    buffer += '[';
+    bool first = true;
+    for(const auto &element : value)
+    {
+        if(!first)
+            buffer += ',';
+        first = false;
+        mq_writeValue(buffer, element);
+    }
+    buffer += ']';
+}
+
+template<typename T> void mq_writeValue(QByteArray &buffer, const QList<T> &value) { mq_writeArray(buffer, value); }
+template<typename T> void mq_writeValue(QByteArray &buffer, const QVector<T> &value) { mq_writeArray(buffer, value); }
+template<typename T> void mq_writeValue(QByteArray &buffer, const std::vector<T> &value) { mq_writeArray(buffer, value); }
+
+template<typename T, typename Fields, std::size_t... I>
+void mq_writeFields(QByteArray &buffer, const T &value, const Fields &fields, const char *exclude, std::index_sequence<I...>)
+{
+    bool first = true;
+    auto write = [&](const char *name, const auto &member)
+    {
+        if(mq_isOmitted(name, member) || (exclude && qstrcmp(name, exclude) == 0))
+            return;
+        if(!first)
+            buffer += ',';
+        first = false;
+
+        buffer += '"';
+        buffer += name;
+        buffer += "\":";
+        mq_writeValue(buffer, member);
+    };
+
+    using expand = int[];
+    (void)expand{ 0, (write(std::get<I>(fields).name, value.*(std::get<I>(fields).member)), 0)... };
+}
+
+//Object of a mapped struct, the member serialized as exclude is left out
+template<typename T>
+void mq_writeObject(QByteArray &buffer, const T &value, const char *exclude)
+{
+    constexpr auto fields = mq_mapping<T>::fields();
+
+    buffer += '{';
+    mq_writeFields(buffer, value, fields, exclude, std::make_index_sequence<std::tuple_size<decltype(fields)>::value>());
+    buffer += '}';
+}
+
+template<typename T>
+typename std::enable_if<mq_isMapped<T>::value>::type mq_writeValue(QByteArray &buffer, const T &value)
+{
+    mq_writeObject(buffer, value, nullptr);
+}
+
+template<typename Container>
+bool mq_readArray(mqjsonreader &reader, Container &value)
+{
+    value.clear();
+    if(!reader.beginArray())
+        return false;
+
+    while(reader.nextElement())
+    {
+        typename Container::value_type element{};
+        if(!reader.readNull() && !mq_readValue(reader, element))
+            return false;
+        value.push_back(element);
+    }
+
+    return reader.ok();
+}
+
+template<typename T> bool mq_readValue(mqjsonreader &reader, QList<T> &value) { return mq_readArray(reader, value); }
+template<typename T> bool mq_readValue(mqjsonreader &reader, QVector<T> &value) { return mq_readArray(reader, value); }
+template<typename T> bool mq_readValue(mqjsonreader &reader, std::vector<T> &value) { return mq_readArray(reader, value); }
+
+template<typename T, typename Fields, std::size_t... I>
+bool mq_readField(mqjsonreader &reader, T &value, const Fields &fields, std::index_sequence<I...>)
+{
+    bool matched = false;
+    bool ok = true;
+    auto read = [&](const char *name, auto &member)
+    {
+        if(matched || !reader.keyEquals(name))
+            return;
+        matched = true;
+        ok = reader.readNull() || mq_readValue(reader, member);
+    };
+
+    using expand = int[];
+    (void)expand{ 0, (read(std::get<I>(fields).name, value.*(std::get<I>(fields).member)), 0)... };
+
+    //Fields the struct does not declare are skipped without decoding
+    return matched ? ok : reader.skipValue();
+}
+
+template<typename T>
+typename std::enable_if<mq_isMapped<T>::value, bool>::type mq_readValue(mqjsonreader &reader, T &value)
+{
+    constexpr auto fields = mq_mapping<T>::fields();
+
+    if(!reader.beginObject())
+        return false;
+
+    while(reader.nextKey())
+    {
+        if(!mq_readField(reader, value, fields, std::make_index_sequence<std::tuple_size<decltype(fields)>::value>()))
+            return reader.fail();
+    }
+
+    return reader.ok();
+}
+
+/**
+ * @brief Serialize a mapped struct
+ * @param buffer output, cleared first. Reusing one buffer keeps its capacity between documents
+ */
+template<typename T>
+void mq_toJson(const T &value, QByteArray *buffer)
+{
+    buffer->resize(0);
+    mq_writeValue(*buffer, value);
+}
+
+template<typename T>
+QByteArray mq_toJson(const T &value)
+{
+    QByteArray buffer;
+    buffer.reserve(256);
+    mq_writeValue(buffer, value);
+    return buffer;
+}
+
+/**
+ * @brief Serialize a mapped struct without one of its top-level members
+ * @param exclude JSON name of the member, ex. "_rev" when the revision goes in the query string
+ */
+template<typename T>
+QByteArray mq_toJsonExcept(const T &value, const char *exclude)
+{
+    static_assert(mq_isMapped<T>::value, "mq_toJsonExcept needs a struct declared with MQ_MAPPING");
+
+    QByteArray buffer;
+    buffer.reserve(256);
+    mq_writeObject(buffer, value, exclude);
+    return buffer;
+}
+
+/**
+ * @brief Parse JSON bytes into a mapped struct, members missing from the input keep their values
+ * @return false on malformed input or type mismatch
+ */
+template<typename T>
+bool mq_fromJson(const QByteArray &json, T *value)
+{
+    mqjsonreader reader(json.constData(), json.constData() + json.size());
+    return mq_readValue(reader, *value);
+}
+
+#endif // MQMAPPING_H
@@ -0,0 +1,278 @@
+/**
+ *  @file    mqmetrics.cpp
+ *
+ *  @brief Driver instrumentation
+ *
+ *  @section DESCRIPTION
+ *
+ *  Request counts, bytes, errors, retries and log-bucketed latency
+ *  histograms per CouchDB operation, exported as JSON or Prometheus text
+ */
+
+#include "mqmetrics.h"
+
+#include <QMutexLocker>
+#include <QStringList>
+
+#include <cmath>
+
+mqmetrics::mqmetrics()
+{
+}
+
+void mqmetrics::record(const QString &verb, const QString &url, int status, bool failed,
+                       qint64 micros, qint64 bytesSent, qint64 bytesReceived)
+{
+    QString operation, database;
+    classify(verb, url, &operation, &database);
+
+    QMutexLocker locker(&m_mutex);
+    mq_operationStats &entry = stats(mq_metricKey(operation, database));
+
+    entry.count++;
+    entry.bytesSent += bytesSent;
+    entry.bytesReceived += bytesReceived;
+    entry.totalMicros += micros;
+    entry.maxMicros = qMax(entry.maxMicros, micros);
+    entry.buckets[bucket(micros)]++;
+
+    if(failed)
+    {
+        entry.errors++;
+        entry.errorsByStatus[status]++;
+    }
+}
+
+void mqmetrics::recordRetry(const QString &operation, const QString &database)
+{
+    QMutexLocker locker(&m_mutex);
+    stats(mq_metricKey(operation, database)).retries++;
+}
+
+void mqmetrics::classify(const QString &verb, const QString &url, QString *operation, QString *database)
+{
+    //Plain string scan like mqhttp::origin, QUrl parsing is too slow for every request
+    const int scheme = url.indexOf("://");
+    int begin = scheme < 0 ? 0 : url.indexOf('/', scheme + 3);
+    if(begin < 0)
+        begin = url.size();
+
+    int end = begin;
+    while(end < url.size() && url.at(end) != '?' && url.at(end) != '#')
+        end++;
+
+    const QStringList path = url.mid(begin, end - begin).split('/', QString::SkipEmptyParts);
+
+    database->clear();
+
+    //Server level, ex. /_all_dbs, /_uuids, /
+    if(path.isEmpty() || path.first().startsWith('_'))
+    {
+        *operation = path.isEmpty() ? QString("server") : path.first();
+        return;
+    }
+
+    *database = path.first();
+
+    if(path.count() == 1)
+    {
+        if(verb == "HEAD")
+            *operation = "checkDatabase";
+        else if(verb == "PUT")
+            *operation = "createDatabase";
+        else if(verb == "DELETE")
+            *operation = "removeDatabase";
+        else if(verb == "POST")
+            *operation = "addDocument";
+        else
+            *operation = "getDatabase";
+        return;
+    }
+
+    const QString &segment = path.at(1);
+
+    //Views and other design document endpoints, ex. /db/_design/app/_view/by_name
+    if(segment == "_design" && path.count() >= 4)
+    {
+        //Anything else is an attachment of the design document, its name must not become a label
+        *operation = path.at(3).startsWith('_') ? path.at(3) : QString("attachment");
+        return;
+    }
+
+    if(segment.startsWith('_') && segment != "_design" && segment != "_local")
+    {
+        *operation = segment;
+        return;
+    }
+
+    //Document id, _design/<name> and _local/<name> ids span two segments
+    const int attachmentIndex = segment.startsWith('_') ? 3 : 2;
+
+    if(path.count() > attachmentIndex)
+    {
+        if(verb == "PUT")
+            *operation = "addAttachment";
+        else if(verb == "DELETE")
+            *operation = "removeAttachment";
+        else
+            *operation = "getAttachment";
+        return;
+    }
+
+    if(verb == "HEAD")
+        *operation = "getRevision";
+    else if(verb == "PUT")
+        *operation = "updateDocument";
+    else if(verb == "DELETE")
+        *operation = "removeDocument";
+    else
+        *operation = "getDocument";
+}
+
+qint64 mqmetrics::percentile(const QString &operation, const QString &database, double quantile) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    auto it = m_stats.constFind(mq_metricKey(operation, database));
+    if(it == m_stats.constEnd())
+        return 0;
+
+    return percentile(it.value(), quantile);
+}
+
+QJsonDocument mqmetrics::toJson() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    QJsonArray operations;
+    for(auto it = m_stats.constBegin(); it != m_stats.constEnd(); ++it)
+    {
+        const mq_operationStats &entry = it.value();
+
+        QJsonObject errors;
+        for(auto status = entry.errorsByStatus.constBegin(); status != entry.errorsByStatus.constEnd(); ++status)
+            errors.insert(QString::number(status.key()), double(status.value()));
+
+        QJsonObject latency = {
+            {"p50", double(percentile(entry, 0.5))},
+            {"p99", double(percentile(entry, 0.99))},
+            {"p999", double(percentile(entry, 0.999))},
+            {"max", double(entry.maxMicros)},
+            {"mean", entry.count ? double(entry.totalMicros) / entry.count : 0.0}
+        };
+
+        operations.append(QJsonObject{
+            {"operation", it.key().first},
+            {"database", it.key().second},
+            {"count", double(entry.count)},
+            {"errors", double(entry.errors)},
+            {"errorsByStatus", errors},
+            {"retries", double(entry.retries)},
+            {"bytesSent", double(entry.bytesSent)},
+            {"bytesReceived", double(entry.bytesReceived)},
+            {"latencyMicros", latency}
+        });
+    }
+
+    return QJsonDocument(QJsonObject{ {"operations", operations} });
+}
+
+QByteArray mqmetrics::toPrometheus() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    QByteArray requests = "# TYPE mq_requests_total counter\n";
+    QByteArray errors = "# TYPE mq_request_errors_total counter\n";
+    QByteArray retries = "# TYPE mq_retries_total counter\n";
+    QByteArray sent = "# TYPE mq_bytes_sent_total counter\n";
+    QByteArray received = "# TYPE mq_bytes_received_total counter\n";
+    QByteArray duration = "# TYPE mq_request_duration_seconds summary\n";
+
+    for(auto it = m_stats.constBegin(); it != m_stats.constEnd(); ++it)
+    {
+        const mq_operationStats &entry = it.value();
+        const QByteArray label = labels(it.key());
+
+        requests += "mq_requests_total{" + label + "} " + QByteArray::number(entry.count) + "\n";
+        retries += "mq_retries_total{" + label + "} " + QByteArray::number(entry.retries) + "\n";
+        sent += "mq_bytes_sent_total{" + label + "} " + QByteArray::number(entry.bytesSent) + "\n";
+        received += "mq_bytes_received_total{" + label + "} " + QByteArray::number(entry.bytesReceived) + "\n";
+
+        for(auto status = entry.errorsByStatus.constBegin(); status != entry.errorsByStatus.constEnd(); ++status)
+            errors += "mq_request_errors_total{" + label + ",status=\"" + QByteArray::number(status.key()) + "\"} "
+                    + QByteArray::number(status.value()) + "\n";
+
+        for(double quantile : {0.5, 0.99, 0.999})
+            duration += "mq_request_duration_seconds{" + label + ",quantile=\"" + QByteArray::number(quantile) + "\"} "
+                    + QByteArray::number(percentile(entry, quantile) / 1e6) + "\n";
+
+        duration += "mq_request_duration_seconds_sum{" + label + "} " + QByteArray::number(entry.totalMicros / 1e6) + "\n";
+        duration += "mq_request_duration_seconds_count{" + label + "} " + QByteArray::number(entry.count) + "\n";
+    }
+
+    return requests + errors + retries + sent + received + duration;
+}
+
+void mqmetrics::reset()
+{
+    QMutexLocker locker(&m_mutex);
+    m_stats.clear();
+}
+
+mqmetrics::mq_operationStats &mqmetrics::stats(const mq_metricKey &key)
+{
+    auto it = m_stats.find(key);
+    if(it == m_stats.end())
+    {
+        it = m_stats.insert(key, mq_operationStats());
+        it->buckets.fill(0, BUCKETS);
+    }
+
+    return it.value();
+}
+
+int mqmetrics::bucket(qint64 micros)
+{
+    if(micros <= 1)
+        return 0;
+
+    const int index = int(std::log2(double(micros)) * BUCKETS_PER_OCTAVE);
+    return qMin(index, int(BUCKETS) - 1);
+}
+
+qint64 mqmetrics::bucketLimit(int index)
+{
+    return qint64(std::ceil(std::exp2(double(index + 1) / BUCKETS_PER_OCTAVE)));
+}
+
+qint64 mqmetrics::percentile(const mq_operationStats &stats, double quantile)
+{
+    if(stats.count == 0)
+        return 0;
+
+    //Rank of the sample at quantile, reported as the upper bound of its bucket
+    const quint64 rank = quint64(std::ceil(quantile * stats.count));
+    quint64 seen = 0;
+
+    for(int i = 0; i < stats.buckets.count(); i++)
+    {
+        seen += stats.buckets.at(i);
+        if(seen >= rank && seen > 0)
+            return qMin(bucketLimit(i), stats.maxMicros);
+    }
+
+    return stats.maxMicros;
+}
+
+QByteArray mqmetrics::labels(const mq_metricKey &key)
+{
+    return "operation=\"" + escapeLabel(key.first) + "\",database=\"" + escapeLabel(key.second) + "\"";
+}
+
+QByteArray mqmetrics::escapeLabel(const QString &value)
+{
+    //Exposition format escapes of label values
+    QByteArray escaped = value.toUtf8();
+    escaped.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+    return escaped;
+}
@@ -0,0 +1,87 @@
+#ifndef MQMETRICS_H
+#define MQMETRICS_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+/**
+ * @brief Request counters and latency histograms per operation and database
+ *
+ * mqhttp records every finished request when a metrics object is attached with
+ * mqhttp::setMetrics(). Operations are named from the verb and the CouchDB path,
+ * ex. GET /albums/abc is getDocument on albums. Recording is thread-safe, one
+ * object can be shared by the clients of an mqpool.
+ */
+class mqmetrics
+{
+public:
+    mqmetrics();
+
+    /**
+     * @brief Add one finished request
+     * @param status http status, 0 when the request failed before a response
+     * @param micros time from sending to the end of the response
+     */
+    void record(const QString &verb, const QString &url, int status, bool failed,
+                qint64 micros, qint64 bytesSent, qint64 bytesReceived);
+
+    /// @brief Count a retried request, ex. a write repeated after 409 Conflict
+    void recordRetry(const QString &operation, const QString &database);
+
+    /**
+     * @brief Name the CouchDB operation of a request
+     * @param operation ex. getDocument, _all_docs, _bulk_docs, getAttachment
+     * @param database empty for server level requests
+     */
+    static void classify(const QString &verb, const QString &url, QString *operation, QString *database);
+
+    /// @return latency in microseconds at quantile (0..1) of an operation, 0 when it was not seen
+    qint64 percentile(const QString &operation, const QString &database, double quantile) const;
+
+    /// @return snapshot with counts, bytes, errors by status, retries and p50/p99/p999 latencies
+    QJsonDocument toJson() const;
+    /// @return snapshot in Prometheus text exposition format
+    QByteArray toPrometheus() const;
+
+    void reset();
+
+private:
+    //Quarter-octave buckets, bucket i holds latencies below 2^((i + 1) / 4) microseconds
+    enum { BUCKETS_PER_OCTAVE = 4, BUCKETS = 40 * BUCKETS_PER_OCTAVE };
+
+    typedef struct mq_operationStats{
+        quint64 count = 0;
+        quint64 errors = 0;
+        quint64 retries = 0;
+        qint64 bytesSent = 0;
+        qint64 bytesReceived = 0;
+        qint64 totalMicros = 0;
+        qint64 maxMicros = 0;
+        QMap<int, quint64> errorsByStatus;
+        QVector<quint64> buckets;
+    } mq_operationStats;
+
+    typedef QPair<QString, QString> mq_metricKey;
+
+    mq_operationStats &stats(const mq_metricKey &key);
+    static int bucket(qint64 micros);
+    static qint64 bucketLimit(int index);
+    static qint64 percentile(const mq_operationStats &stats, double quantile);
+    static QByteArray labels(const mq_metricKey &key);
+    static QByteArray escapeLabel(const QString &value);
+
+    mutable QMutex m_mutex;
+    //Operation and database
+    QMap<mq_metricKey, mq_operationStats> m_stats;
+};
+
+#endif // MQMETRICS_H
@@ -0,0 +1,115 @@
+/**
+ *  @file    mqpool.cpp
+ *
+ *  @brief Worker pool of CouchDB clients
+ *
+ *  @section DESCRIPTION
+ *
+ *  Runs one mqhttp/mqcouch pair per thread so database work from
+ *  many threads is spread over several connection managers
+ */
+
+#include "mqpool.h"
+
+mqpool::mqpool(QString connectionUrl, int workers, bool debug, QObject *parent) : QObject(parent), m_next(0)
+{
+    startWorkers(QStringList() << connectionUrl, workers, debug);
+}
+
+mqpool::mqpool(QStringList nodes, int workers, bool debug, QObject *parent) : QObject(parent), m_next(0)
+{
+    startWorkers(nodes, workers, debug);
+}
+
+void mqpool::startWorkers(const QStringList &nodes, int workers, bool debug)
+{
+    if(workers <= 0)
+        workers = qMax(1, QThread::idealThreadCount());
+
+    for(int i = 0; i < workers; i++)
+    {
+        mq_worker worker;
+        worker.thread = new QThread();
+        worker.thread->setObjectName("mqpool-" + QString::number(i));
+        worker.context = new QObject();
+        worker.context->moveToThread(worker.thread);
+        worker.queue = std::make_shared<mq_taskQueue>();
+        worker.thread->start();
+
+        //Network objects are created on their own thread, QNetworkAccessManager is bound to it
+        QMetaObject::invokeMethod(worker.context, [&worker, nodes, debug]()
+        {
+            worker.http = new mqhttp();
+            if(nodes.count() == 1)
+                worker.couch = new mqcouch(worker.http, nodes.first(), debug);
+            else
+                worker.couch = new mqcouch(worker.http, nodes, debug);
+        }, Qt::BlockingQueuedConnection);
+
+        m_workers.append(worker);
+    }
+}
+
+mqpool::~mqpool()
+{
+    for(mq_worker &worker : m_workers)
+    {
+        QMetaObject::invokeMethod(worker.context, [&worker]()
+        {
+            delete worker.couch;
+            delete worker.http;
+        }, Qt::BlockingQueuedConnection);
+
+        worker.thread->quit();
+        worker.thread->wait();
+        delete worker.context;
+        delete worker.thread;
+    }
+}
+
+void mqpool::forEach(std::function<void(mqcouch*)> task)
+{
+    for(const mq_worker &worker : m_workers)
+    {
+        mqcouch *couch = worker.couch;
+        QMetaObject::invokeMethod(worker.context, [task, couch]() { task(couch); }, Qt::BlockingQueuedConnection);
+    }
+}
+
+void mqpool::setMetrics(mqmetrics *metrics)
+{
+    for(const mq_worker &worker : m_workers)
+    {
+        mqhttp *http = worker.http;
+        QMetaObject::invokeMethod(worker.context, [http, metrics]() { http->setMetrics(metrics); }, Qt::BlockingQueuedConnection);
+    }
+}
+
+void mqpool::drain(const std::shared_ptr<mq_taskQueue> &queue)
+{
+    //Posted again from inside a task, mqhttp::exec's event loop must not start the next one
+    if(queue->running)
+        return;
+
+    queue->running = true;
+    while(true)
+    {
+        std::function<void()> task;
+        {
+            QMutexLocker locker(&queue->mutex);
+            if(queue->tasks.empty())
+                break;
+
+            task = std::move(queue->tasks.front());
+            queue->tasks.pop_front();
+        }
+
+        task();
+    }
+    queue->running = false;
+}
+
+int mqpool::nextWorker()
+{
+    return int(m_next.fetchAndAddRelaxed(1) % quint32(m_workers.count()));
+}
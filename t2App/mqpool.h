@@ -0,0 +1,133 @@
+#ifndef MQPOOL_H
+#define MQPOOL_H
+
+#include <QObject>
+
+#include "mqhttp.h"
+#include "mqcouch.h"
+
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QMetaObject>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+
+/**
+ * @brief Thread-safe facade over one mqhttp/mqcouch pair per worker thread
+ *
+ * QNetworkAccessManager is thread-affine, so every worker owns its own manager
+ * and connections. Tasks get the worker's mqcouch and run on that thread, the
+ * result comes back through a std::future. submit() may be called from any thread.
+ */
+class mqpool : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @param connectionUrl server url, ex. http://localhost:5984
+     * @param workers worker threads, 0 uses QThread::idealThreadCount()
+     */
+    explicit mqpool(QString connectionUrl, int workers = 0, bool debug = false, QObject *parent = 0);
+    /**
+     * @brief Pool of cluster clients, every worker balances over the nodes and runs its own health checks
+     * @param nodes node urls, configure balancing of each worker with forEach() and mqcouch::cluster()
+     */
+    explicit mqpool(QStringList nodes, int workers = 0, bool debug = false, QObject *parent = 0);
+    ~mqpool();
+
+    int workerCount() const { return m_workers.count(); }
+
+    /**
+     * @brief Run a task on the next worker, round-robin
+     * @param task called as task(mqcouch*) on the worker thread
+     * @return future of the task's result
+     * @note blocking on the future from inside a pool task can deadlock the worker
+     */
+    template<typename Task>
+    std::future<typename std::result_of<Task(mqcouch*)>::type> submit(Task task)
+    {
+        return submitTo(nextWorker(), task);
+    }
+
+    /**
+     * @brief Run a task on the worker owning key, tasks with the same key run in submit order
+     * @param key sharding key, ex. document id or database name
+     * @note a worker runs one task at a time from its FIFO, the next task starts after the
+     *       previous one returned even while a blocking mqcouch call spins a nested event loop
+     */
+    template<typename Task>
+    std::future<typename std::result_of<Task(mqcouch*)>::type> submit(const QString &key, Task task)
+    {
+        return submitTo(int(qHash(key) % uint(m_workers.count())), task);
+    }
+
+    /**
+     * @brief Run a task once on every worker and wait for all of them
+     * @note use it for configuration, ex. setDocumentCache or setConflictRetries.
+     *       It must not be called from a pool task
+     */
+    void forEach(std::function<void(mqcouch*)> task);
+
+    /// @brief Record the requests of every worker in metrics, it is shared and not owned
+    void setMetrics(mqmetrics *metrics);
+
+private:
+    typedef struct mq_taskQueue{
+        QMutex mutex;
+        std::deque<std::function<void()>> tasks;
+        //A task is on the stack of the worker thread, only touched by that thread
+        bool running = false;
+    } mq_taskQueue;
+
+    static void drain(const std::shared_ptr<mq_taskQueue> &queue);
+
+    typedef struct mq_worker{
+        QThread *thread;
+        //Lives in thread, tasks are queued to it
+        QObject *context;
+        mqhttp *http;
+        mqcouch *couch;
+        //Tasks waiting for the worker, shared with the drain calls posted to its thread
+        std::shared_ptr<mq_taskQueue> queue;
+    } mq_worker;
+
+    void startWorkers(const QStringList &nodes, int workers, bool debug);
+    int nextWorker();
+
+    template<typename Task>
+    std::future<typename std::result_of<Task(mqcouch*)>::type> submitTo(int index, Task task)
+    {
+        typedef typename std::result_of<Task(mqcouch*)>::type Result;
+
+        const mq_worker &worker = m_workers.at(index);
+        mqcouch *couch = worker.couch;
+
+        auto packaged = std::make_shared<std::packaged_task<Result()>>([task, couch]() { return task(couch); });
+        std::future<Result> result = packaged->get_future();
+
+        std::shared_ptr<mq_taskQueue> queue = worker.queue;
+        {
+            QMutexLocker locker(&queue->mutex);
+            queue->tasks.push_back([packaged]() { (*packaged)(); });
+        }
+
+        //Nested event loops of a running task pick this up and return, the outer drain runs the task
+        QMetaObject::invokeMethod(worker.context, [queue]() { drain(queue); }, Qt::QueuedConnection);
+
+        return result;
+    }
+
+    QVector<mq_worker> m_workers;
+    QAtomicInteger<quint32> m_next;
+};
+
+#endif // MQPOOL_H
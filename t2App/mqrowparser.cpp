@@ -0,0 +1,151 @@
+/**
+ *  @file    mqrowparser.cpp
+ *
+ *  @brief Streaming parser for CouchDB row responses
+ *
+ *  @section DESCRIPTION
+ *
+ *  Splits {"rows":[...]} style envelopes into rows while bytes are still
+ *  downloading, without building a DOM for the whole response
+ */
+
+#include "mqrowparser.h"
+
+mqrowparser::mqrowparser(const QByteArray &arrayKey, mq_rowCallback callback)
+{
+    m_arrayKey = arrayKey;
+    m_callback = callback;
+
+    m_rowDepth = arrayKey.isEmpty() ? 0 : 2;
+    m_inArray = arrayKey.isEmpty();
+}
+
+void mqrowparser::feed(const QByteArray &chunk)
+{
+    for(const char c : chunk)
+    {
+        const bool inRow = m_inArray && m_depth > m_rowDepth;
+
+        if(m_inString)
+        {
+            if(inRow)
+                m_row += c;
+            else if(!m_inArray)
+                m_envelope += c;
+
+            if(m_escape)
+                m_escape = false;
+            else if(c == '\\')
+                m_escape = true;
+            else if(c == '"')
+                m_inString = false;
+            else if(m_depth == 1 && !m_inArray)
+                m_string += c;
+
+            continue;
+        }
+
+        if(inRow)
+        {
+            m_row += c;
+
+            if(c == '"')
+                m_inString = true;
+            else if(c == '{' || c == '[')
+                m_depth++;
+            else if(c == '}' || c == ']')
+            {
+                m_depth--;
+                if(m_depth == m_rowDepth)
+                    emitRow();
+            }
+
+            continue;
+        }
+
+        if(m_inArray)
+        {
+            //Between rows, only separators and the end of the array are expected
+            if(c == '"')
+                m_inString = true;
+            else if(c == '{' || c == '[')
+            {
+                m_row = QByteArray(1, c);
+                m_depth++;
+            }
+            else if(c == ']' && m_rowDepth > 0)
+            {
+                m_depth--;
+                m_inArray = false;
+                m_envelope += c;
+            }
+
+            continue;
+        }
+
+        m_envelope += c;
+
+        if(c == '"')
+        {
+            m_inString = true;
+            m_string.clear();
+        }
+        else if(c == ':' && m_depth == 1)
+            m_key = m_string;
+        else if(c == ',' && m_depth == 1)
+            m_key.clear();
+        else if(c == '{' || c == '[')
+        {
+            m_depth++;
+            if(c == '[' && m_depth == m_rowDepth && m_key == m_arrayKey)
+                m_inArray = true;
+        }
+        else if(c == '}' || c == ']')
+            m_depth--;
+    }
+}
+
+bool mqrowparser::isComplete() const
+{
+    return m_depth == 0 && !m_inString && m_errorCount == 0;
+}
+
+QJsonObject mqrowparser::envelope() const
+{
+    return QJsonDocument::fromJson(m_envelope).object();
+}
+
+void mqrowparser::emitRow()
+{
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(m_row, &error);
+    m_row.clear();
+
+    if(error.error != QJsonParseError::NoError || !doc.isObject())
+    {
+        m_errorCount++;
+        return;
+    }
+
+    m_rowCount++;
+
+    if(m_callback)
+        m_callback(doc.object());
+}
+
+_mq_document mq_rowDocument(const QJsonObject &row)
+{
+    return _mq_document{ .id = row["id"].toString(), .rev = QJsonObject(row["value"].toObject())["rev"].toString(), .ok = true };
+}
+
+QList<_mq_document> mq_documentList(const QJsonObject &allDocs)
+{
+    const QJsonArray rows = allDocs["rows"].toArray();
+
+    QList<_mq_document> data;
+    data.reserve(rows.count());
+    for(const QJsonValue &row : rows)
+        data.push_back(mq_rowDocument(row.toObject()));
+
+    return data;
+}
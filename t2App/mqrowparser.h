@@ -0,0 +1,77 @@
+#ifndef MQROWPARSER_H
+#define MQROWPARSER_H
+
+#include "mqcouch_types.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonParseError>
+
+#include <functional>
+
+//Row handler of the streaming parser, called once per complete row
+typedef std::function<void(const QJsonObject &)> mq_rowCallback;
+
+/// @return id and revision of an _all_docs row
+_mq_document mq_rowDocument(const QJsonObject &row);
+/// @return documents of a parsed _all_docs response, empty when it has no rows
+QList<_mq_document> mq_documentList(const QJsonObject &allDocs);
+
+/**
+ * @brief Incremental parser for CouchDB row envelopes
+ *
+ * Bytes are fed as they arrive from the network. Every element of the row array
+ * ({"rows":[...]} for _all_docs and views, {"results":[...]} for _changes) is parsed
+ * alone and handed to the callback, so only one row is held in memory at a time.
+ * With an empty array key the input is treated as a stream of top-level objects,
+ * which is the format of continuous _changes feeds.
+ */
+class mqrowparser
+{
+public:
+    explicit mqrowparser(const QByteArray &arrayKey = "rows", mq_rowCallback callback = mq_rowCallback());
+
+    void setCallback(mq_rowCallback callback) { m_callback = callback; }
+
+    /// @brief Parse next chunk of the response, rows completed by it are emitted immediately
+    void feed(const QByteArray &chunk);
+
+    /// @return input ended on a value boundary and every row was valid JSON
+    bool isComplete() const;
+
+    /**
+     * @return fields around the row array, ex. {"total_rows":6,"offset":0,"rows":[]}
+     * @note rows are not kept, the array is always empty
+     */
+    QJsonObject envelope() const;
+
+    int rowCount() const { return m_rowCount; }
+    int errorCount() const { return m_errorCount; }
+
+private:
+    void emitRow();
+
+    QByteArray m_arrayKey;
+    mq_rowCallback m_callback;
+
+    //Depth where rows start, 2 inside {"rows":[ and 0 for a stream of objects
+    int m_rowDepth;
+    int m_depth = 0;
+    bool m_inArray;
+    bool m_inString = false;
+    bool m_escape = false;
+
+    //Last string and key seen directly in the envelope object
+    QByteArray m_string;
+    QByteArray m_key;
+
+    QByteArray m_row;
+    QByteArray m_envelope;
+    int m_rowCount = 0;
+    int m_errorCount = 0;
+};
+
+#endif // MQROWPARSER_H
@@ -9,9 +9,20 @@ CONFIG -= app_bundle
 
 TEMPLATE = app
 
+LIBS += -lz
+
 SOURCES += main.cpp \
     mqhttp.cpp \
-    mqcouch.cpp
+    mqcouch.cpp \
+    mqrowparser.cpp \
+    mqchanges.cpp \
+    mqcache.cpp \
+    mqcluster.cpp \
+    mqdocument.cpp \
+    mqpool.cpp \
+    mqmetrics.cpp \
+    mqload.cpp \
+    mqmapping.cpp
 
 # The following define makes your compiler emit warnings if you use
 # any feature of Qt which as been marked deprecated (the exact warnings
@@ -27,4 +38,13 @@ DEFINES += QT_DEPRECATED_WARNINGS
 HEADERS += \
     mqhttp.h \
     mqcouch.h \
-    mqcouch_types.h
+    mqcouch_types.h \
+    mqrowparser.h \
+    mqchanges.h \
+    mqcache.h \
+    mqcluster.h \
+    mqdocument.h \
+    mqpool.h \
+    mqmetrics.h \
+    mqload.h \
+    mqmapping.h
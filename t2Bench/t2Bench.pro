@@ -0,0 +1,30 @@
+QT += core network testlib
+QT -= gui
+
+CONFIG += c++14
+
+TARGET = t2Bench
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../t2App
+
+LIBS += -lz
+
+# Driver sources are built in, the benchmarks call them without a server
+SOURCES += benchmark.cpp \
+    ../t2App/mqrowparser.cpp \
+    ../t2App/mqdocument.cpp \
+    ../t2App/mqmetrics.cpp \
+    ../t2App/mqhttp.cpp
+
+HEADERS += \
+    ../t2App/mqcouch_types.h \
+    ../t2App/mqrowparser.h \
+    ../t2App/mqdocument.h \
+    ../t2App/mqmetrics.h \
+    ../t2App/mqhttp.h
+
+DEFINES += QT_DEPRECATED_WARNINGS
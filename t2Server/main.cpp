@@ -0,0 +1,48 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+
+#include "mqfakecouch.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("t2Server");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("In-memory CouchDB stand-in for driver benchmarks and fault tests");
+    parser.addHelpOption();
+    parser.addOptions({
+        { "port", "Listen port, 0 picks a free one.", "port", "5984" },
+        { "latency", "Milliseconds added to every response.", "ms", "0" },
+        { "jitter", "Random milliseconds added on top of latency.", "ms", "0" },
+        { "bandwidth", "Response bytes per second, 0 is unlimited.", "bytes", "0" },
+        { "conflict-rate", "Share of document writes answered with 409.", "rate", "0" },
+        { "error-rate", "Share of requests answered with 500.", "rate", "0" },
+        { "timeout-rate", "Share of requests never answered.", "rate", "0" },
+        { "padding", "Filler bytes added to JSON object responses.", "bytes", "0" },
+        { "seed", "Seed of jitter and injected faults.", "seed", "1" }
+    });
+    parser.process(a);
+
+    _mq_fakeOptions options;
+    options.latency = parser.value("latency").toInt();
+    options.jitter = parser.value("jitter").toInt();
+    options.bytesPerSecond = parser.value("bandwidth").toLongLong();
+    options.conflictRate = parser.value("conflict-rate").toDouble();
+    options.errorRate = parser.value("error-rate").toDouble();
+    options.timeoutRate = parser.value("timeout-rate").toDouble();
+    options.padding = parser.value("padding").toInt();
+    options.seed = parser.value("seed").toUInt();
+
+    mqfakecouch server(options);
+    if(!server.listen(QHostAddress::LocalHost, quint16(parser.value("port").toUInt())))
+    {
+        qCritical() << "Can not listen on port" << parser.value("port");
+        return 1;
+    }
+
+    qInfo() << "Fake CouchDB listening on" << server.url();
+
+    return a.exec();
+}
@@ -0,0 +1,825 @@
+/**
+ *  @file    mqfakecouch.cpp
+ *
+ *  @brief Fake CouchDB server
+ *
+ *  @section DESCRIPTION
+ *
+ *  Minimal HTTP/1.1 server on QTcpServer with an in-memory CouchDB
+ *  document model, used to benchmark and fault test the driver offline
+ */
+
+#include "mqfakecouch.h"
+
+#include <QCryptographicHash>
+#include <QTimer>
+#include <QUrl>
+
+#include <zlib.h>
+#include <algorithm>
+#include <cstring>
+
+static QByteArray statusText(int status)
+{
+    switch(status)
+    {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Object Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 412: return "Precondition Failed";
+    case 416: return "Requested Range Not Satisfiable";
+    case 500: return "Internal Server Error";
+    default: return "Unknown";
+    }
+}
+
+//Revision from If-Match, ex. "1-8ecb908f..."
+static QString unquote(const QByteArray &value)
+{
+    QByteArray text = value.trimmed();
+    if(text.startsWith('"') && text.endsWith('"') && text.size() >= 2)
+        text = text.mid(1, text.size() - 2);
+
+    return QString::fromLatin1(text);
+}
+
+//startkey/endkey/key parameters are JSON encoded
+static QString jsonKey(const QString &value)
+{
+    return QJsonDocument::fromJson("[" + value.toUtf8() + "]").array().at(0).toString();
+}
+
+mqfakecouch::mqfakecouch(_mq_fakeOptions options, QObject *parent) : QObject(parent), m_random(options.seed)
+{
+    m_options = options;
+    m_clock.start();
+    m_uuid = newUuid();
+
+    m_server = new QTcpServer(this);
+    connect(m_server, &QTcpServer::newConnection, this, &mqfakecouch::onNewConnection);
+}
+
+bool mqfakecouch::listen(const QHostAddress &address, quint16 port)
+{
+    return m_server->listen(address, port);
+}
+
+QString mqfakecouch::url() const
+{
+    return "http://" + m_server->serverAddress().toString() + ":" + QString::number(m_server->serverPort());
+}
+
+void mqfakecouch::setOptions(_mq_fakeOptions options)
+{
+    m_options = options;
+    m_random.seed(options.seed);
+}
+
+void mqfakecouch::onNewConnection()
+{
+    while(m_server->hasPendingConnections())
+    {
+        QTcpSocket *socket = m_server->nextPendingConnection();
+        m_buffers.insert(socket, QByteArray());
+
+        connect(socket, &QTcpSocket::readyRead, this, &mqfakecouch::onReadyRead);
+        connect(socket, &QTcpSocket::disconnected, this, &mqfakecouch::onDisconnected);
+    }
+}
+
+void mqfakecouch::onReadyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if(!socket)
+        return;
+
+    m_buffers[socket].append(socket->readAll());
+    process(socket);
+}
+
+void mqfakecouch::onDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if(!socket)
+        return;
+
+    m_buffers.remove(socket);
+    m_busy.remove(socket);
+    socket->deleteLater();
+}
+
+void mqfakecouch::process(QTcpSocket *socket)
+{
+    //Timer of a delayed response may fire after the client disconnected
+    if(!m_buffers.contains(socket))
+        return;
+
+    mq_fakeRequest request;
+    if(m_busy.contains(socket) || !parseRequest(&m_buffers[socket], &request))
+        return;
+
+    m_requests++;
+    m_busy.insert(socket);
+
+    //Injected timeout, the connection stays busy until the client gives up
+    if(roll(m_options.timeoutRate))
+        return;
+
+    mq_fakeResponse response;
+    bool ok = true;
+
+    if(request.headers.value("content-encoding") == "gzip")
+        request.body = inflate(request.body, &ok);
+
+    if(!ok)
+        response = error(400, "bad_request", "Invalid gzip body");
+    else if(roll(m_options.errorRate))
+        response = error(500, "unknown_error", "Injected failure");
+    else
+        response = handle(request);
+
+    qint64 delay = m_options.latency;
+    if(m_options.jitter > 0)
+        delay += std::uniform_int_distribution<int>(0, m_options.jitter)(m_random);
+
+    //Responses share one link, each waits for the previous one to be transmitted
+    if(m_options.bytesPerSecond > 0)
+    {
+        const qint64 now = m_clock.elapsed();
+        const qint64 transfer = qint64(response.body.size()) * 1000 / m_options.bytesPerSecond;
+
+        m_linkFreeAt = qMax(m_linkFreeAt, now + delay) + transfer;
+        delay = m_linkFreeAt - now;
+    }
+
+    const bool head = request.verb == "HEAD";
+    QTimer::singleShot(int(delay), socket, [this, socket, response, head]()
+    {
+        send(socket, response, head);
+        m_busy.remove(socket);
+
+        //Next request of a keep-alive connection may already be buffered
+        process(socket);
+    });
+}
+
+bool mqfakecouch::parseRequest(QByteArray *buffer, mq_fakeRequest *request)
+{
+    const int headerEnd = buffer->indexOf("\r\n\r\n");
+    if(headerEnd < 0)
+        return false;
+
+    QList<QByteArray> lines = buffer->left(headerEnd).split('\n');
+    const QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+
+    QHash<QByteArray, QByteArray> headers;
+    for(const QByteArray &line : lines)
+    {
+        const int colon = line.indexOf(':');
+        if(colon > 0)
+            headers.insert(line.left(colon).trimmed().toLower(), line.mid(colon + 1).trimmed());
+    }
+
+    const int length = headers.value("content-length").toInt();
+    if(buffer->size() < headerEnd + 4 + length)
+        return false;
+
+    request->verb = requestLine.value(0);
+    request->headers = headers;
+    request->body = buffer->mid(headerEnd + 4, length);
+    buffer->remove(0, headerEnd + 4 + length);
+
+    //Path segments are decoded one by one, ids may contain an encoded '/'
+    const QByteArray target = requestLine.value(1);
+    const int question = target.indexOf('?');
+    const QByteArray path = question < 0 ? target : target.left(question);
+
+    request->path.clear();
+    for(const QByteArray &segment : path.split('/'))
+    {
+        if(!segment.isEmpty())
+            request->path << QUrl::fromPercentEncoding(segment);
+    }
+
+    request->query = QUrlQuery(question < 0 ? QString() : QString::fromUtf8(target.mid(question + 1)));
+
+    return true;
+}
+
+void mqfakecouch::send(QTcpSocket *socket, const mq_fakeResponse &response, bool head)
+{
+    QByteArray out = "HTTP/1.1 " + QByteArray::number(response.status) + " " + statusText(response.status) + "\r\n";
+    out += "Server: CouchDB/3.3.0 (mqfakecouch)\r\n";
+    out += "Cache-Control: must-revalidate\r\n";
+    out += "Content-Length: " + QByteArray::number(response.body.size()) + "\r\n";
+
+    for(const QPair<QByteArray, QByteArray> &header : response.headers)
+        out += header.first + ": " + header.second + "\r\n";
+
+    out += "\r\n";
+
+    if(!head)
+        out += response.body;
+
+    socket->write(out);
+}
+
+mqfakecouch::mq_fakeResponse mqfakecouch::handle(const mq_fakeRequest &request)
+{
+    const QStringList &path = request.path;
+
+    if(path.isEmpty())
+        return json(200, QJsonObject{ {"couchdb", "Welcome"}, {"version", "3.3.0"}, {"uuid", m_uuid},
+                                      {"vendor", QJsonObject{ {"name", "mqfakecouch"} }} });
+
+    if(path.first() == "_all_dbs")
+        return json(200, QJsonArray::fromStringList(m_databases.keys()));
+
+    if(path.first() == "_up")
+        return json(200, QJsonObject{ {"status", "ok"} });
+
+    if(path.first() == "_uuids")
+    {
+        const int count = qMax(1, request.query.queryItemValue("count").toInt());
+
+        QJsonArray uuids;
+        for(int i = 0; i < count; i++)
+            uuids.append(newUuid());
+
+        return json(200, QJsonObject{ {"uuids", uuids} });
+    }
+
+    if(path.first().startsWith('_'))
+        return error(404, "not_found", "Not supported by the fake server");
+
+    const QString database = path.first();
+    if(path.count() == 1)
+        return handleDatabase(request, database);
+
+    if(!m_databases.contains(database))
+        return error(404, "not_found", "Database does not exist.");
+
+    const QString &segment = path.at(1);
+
+    if(segment == "_all_docs")
+        return allDocs(request, database);
+    if(segment == "_bulk_docs" && request.verb == "POST")
+        return bulkDocs(request, database);
+    if(segment == "_bulk_get" && request.verb == "POST")
+        return bulkGet(request, database);
+
+    //_design/<name> and _local/<name> ids span two segments
+    int next = 2;
+    QString id = segment;
+    if(segment == "_design" || segment == "_local")
+    {
+        if(path.count() < 3)
+            return error(404, "not_found", "missing");
+
+        id = segment + "/" + path.at(2);
+        next = 3;
+    }
+    else if(segment.startsWith('_'))
+        return error(404, "not_found", "Not supported by the fake server");
+
+    if(path.count() == next)
+        return handleDocument(request, database, id);
+
+    return handleAttachment(request, database, id, path.mid(next).join('/'));
+}
+
+mqfakecouch::mq_fakeResponse mqfakecouch::handleDatabase(const mq_fakeRequest &request, const QString &database)
+{
+    const bool exists = m_databases.contains(database);
+
+    if(request.verb == "PUT")
+    {
+        if(exists)
+            return error(412, "file_exists", "The database could not be created, the file already exists.");
+
+        m_databases.insert(database, mq_fakeDatabase());
+        return json(201, QJsonObject{ {"ok", true} });
+    }
+
+    if(!exists)
+        return error(404, "not_found", "Database does not exist.");
+
+    if(request.verb == "GET" || request.verb == "HEAD")
+    {
+        int count = 0, deleted = 0;
+        for(const mq_fakeDocument &document : m_databases[database])
+            document.deleted ? deleted++ : count++;
+
+        return json(200, QJsonObject{ {"db_name", database}, {"doc_count", count}, {"doc_del_count", deleted} });
+    }
+
+    if(request.verb == "DELETE")
+    {
+        m_databases.remove(database);
+        return json(200, QJsonObject{ {"ok", true} });
+    }
+
+    if(request.verb == "POST")
+    {
+        const QJsonDocument body = QJsonDocument::fromJson(request.body);
+        if(!body.isObject())
+            return error(400, "bad_request", "Document must be a JSON object");
+
+        if(roll(m_options.conflictRate))
+            return error(409, "conflict", "Document update conflict.");
+
+        QString id = body.object()["_id"].toString();
+        if(id.isEmpty())
+            id = newUuid();
+
+        return writeResponse(writeDocument(m_databases[database], id, body.object(), body.object()["_rev"].toString(), false), 201);
+    }
+
+    return error(405, "method_not_allowed", "Only GET,HEAD,PUT,POST,DELETE allowed");
+}
+
+mqfakecouch::mq_fakeResponse mqfakecouch::handleDocument(const mq_fakeRequest &request, const QString &database, const QString &id)
+{
+    mq_fakeDatabase &db = m_databases[database];
+    auto it = db.constFind(id);
+    const bool exists = it != db.constEnd() && !it->deleted;
+
+    if(request.verb == "GET" || request.verb == "HEAD")
+    {
+        if(!exists)
+            return error(404, "not_found", it == db.constEnd() ? "missing" : "deleted");
+
+        //Only the leaf revision is kept
+        const QString rev = request.query.queryItemValue("rev", QUrl::FullyDecoded);
+        if(!rev.isEmpty() && rev != it->rev)
+            return error(404, "not_found", "missing");
+
+        const QByteArray etag = "\"" + it->rev.toLatin1() + "\"";
+        if(request.headers.value("if-none-match") == etag)
+            return mq_fakeResponse{ 304, QByteArray(), { qMakePair(QByteArray("ETag"), etag) } };
+
+        mq_fakeResponse response = json(200, documentJson(id, *it));
+        response.headers << qMakePair(QByteArray("ETag"), etag);
+        return response;
+    }
+
+    QString rev = request.query.queryItemValue("rev", QUrl::FullyDecoded);
+    if(rev.isEmpty())
+        rev = unquote(request.headers.value("if-match"));
+
+    if(request.verb == "PUT")
+    {
+        const QJsonDocument body = QJsonDocument::fromJson(request.body);
+        if(!body.isObject())
+            return error(400, "bad_request", "Document must be a JSON object");
+
+        if(roll(m_options.conflictRate))
+            return error(409, "conflict", "Document update conflict.");
+
+        if(rev.isEmpty())
+            rev = body.object()["_rev"].toString();
+
+        return writeResponse(writeDocument(db, id, body.object(), rev, body.object()["_deleted"].toBool()), 201);
+    }
+
+    if(request.verb == "DELETE")
+    {
+        if(roll(m_options.conflictRate))
+            return error(409, "conflict", "Document update conflict.");
+
+        return writeResponse(writeDocument(db, id, QJsonObject(), rev, true), 200);
+    }
+
+    return error(405, "method_not_allowed", "Only GET,HEAD,PUT,DELETE allowed");
+}
+
+mqfakecouch::mq_fakeResponse mqfakecouch::handleAttachment(const mq_fakeRequest &request, const QString &database,
+                                                           const QString &id, const QString &name)
+{
+    mq_fakeDatabase &db = m_databases[database];
+    auto it = db.find(id);
+    const bool exists = it != db.end() && !it->deleted;
+
+    if(request.verb == "GET" || request.verb == "HEAD")
+    {
+        if(!exists || !it->attachments.contains(name))
+            return error(404, "not_found", "Document is missing attachment");
+
+        const mq_fakeAttachment attachment = it->attachments.value(name);
+        const QByteArray digest = attachmentDigest(attachment.data);
+        const qint64 size = attachment.data.size();
+
+        mq_fakeResponse response{ 200, attachment.data, {} };
+        response.headers << qMakePair(QByteArray("Content-Type"), attachment.contentType)
+                         << qMakePair(QByteArray("Accept-Ranges"), QByteArray("bytes"))
+                         << qMakePair(QByteArray("ETag"), "\"" + digest + "\"");
+
+        //Single ranges only: bytes=a-b, bytes=a- and bytes=-n
+        const QByteArray range = request.headers.value("range");
+        if(range.startsWith("bytes=") && !range.contains(','))
+        {
+            const QByteArray spec = range.mid(6);
+            const int dash = spec.indexOf('-');
+            qint64 start, end;
+
+            if(dash == 0)
+            {
+                start = qMax(Q_INT64_C(0), size - spec.mid(1).toLongLong());
+                end = size - 1;
+            }
+            else
+            {
+                start = spec.left(dash).toLongLong();
+                end = spec.mid(dash + 1).isEmpty() ? size - 1 : qMin(size - 1, spec.mid(dash + 1).toLongLong());
+            }
+
+            if(start >= size || start > end)
+                return mq_fakeResponse{ 416, QByteArray(), { qMakePair(QByteArray("Content-Range"), "bytes */" + QByteArray::number(size)) } };
+
+            response.status = 206;
+            response.body = attachment.data.mid(int(start), int(end - start + 1));
+            response.headers << qMakePair(QByteArray("Content-Range"), "bytes " + QByteArray::number(start) + "-"
+                                          + QByteArray::number(end) + "/" + QByteArray::number(size));
+            return response;
+        }
+
+        response.headers << qMakePair(QByteArray("Content-MD5"), digest);
+        return response;
+    }
+
+    QString rev = request.query.queryItemValue("rev", QUrl::FullyDecoded);
+    if(rev.isEmpty())
+        rev = unquote(request.headers.value("if-match"));
+
+    const QString current = it != db.end() ? it->rev : QString();
+
+    if(request.verb == "PUT")
+    {
+        if(roll(m_options.conflictRate) || (exists && rev != current) || (!exists && !rev.isEmpty() && rev != current))
+            return error(409, "conflict", "Document update conflict.");
+
+        mq_fakeDocument document = exists ? *it : mq_fakeDocument();
+        QByteArray contentType = request.headers.value("content-type");
+        if(contentType.isEmpty())
+            contentType = "application/octet-stream";
+
+        document.attachments.insert(name, mq_fakeAttachment{ contentType, request.body });
+        document.rev = nextRev(current, document.body);
+        db.insert(id, document);
+
+        return writeResponse(QJsonObject{ {"ok", true}, {"id", id}, {"rev", document.rev} }, 201);
+    }
+
+    if(request.verb == "DELETE")
+    {
+        if(!exists || !it->attachments.contains(name))
+            return error(404, "not_found", "Document is missing attachment");
+        if(roll(m_options.conflictRate) || rev != current)
+            return error(409, "conflict", "Document update conflict.");
+
+        it->attachments.remove(name);
+        it->rev = nextRev(current, it->body);
+
+        return writeResponse(QJsonObject{ {"ok", true}, {"id", id}, {"rev", it->rev} }, 200);
+    }
+
+    return error(405, "method_not_allowed", "Only GET,HEAD,PUT,DELETE allowed");
+}
+
+mqfakecouch::mq_fakeResponse mqfakecouch::allDocs(const mq_fakeRequest &request, const QString &database)
+{
+    const mq_fakeDatabase &db = m_databases[database];
+    const QUrlQuery &query = request.query;
+
+    auto flag = [&query](const QString &name, bool fallback)
+    {
+        return query.hasQueryItem(name) ? query.queryItemValue(name) == "true" : fallback;
+    };
+    auto param = [&query](const QString &name, const QString &alias)
+    {
+        return query.hasQueryItem(name) ? query.queryItemValue(name, QUrl::FullyDecoded)
+                                        : query.queryItemValue(alias, QUrl::FullyDecoded);
+    };
+
+    const bool descending = flag("descending", false);
+    const bool includeDocs = flag("include_docs", false);
+    const bool inclusiveEnd = flag("inclusive_end", true);
+    const int limit = query.hasQueryItem("limit") ? query.queryItemValue("limit").toInt() : -1;
+    const int skip = query.queryItemValue("skip").toInt();
+
+    //Keys come from a POST body or a JSON encoded parameter
+    QJsonArray keys;
+    bool byKeys = false;
+    if(request.verb == "POST")
+    {
+        keys = QJsonDocument::fromJson(request.body).object()["keys"].toArray();
+        byKeys = true;
+    }
+    else if(query.hasQueryItem("keys"))
+    {
+        keys = QJsonDocument::fromJson(query.queryItemValue("keys", QUrl::FullyDecoded).toUtf8()).array();
+        byKeys = true;
+    }
+    else if(query.hasQueryItem("key"))
+    {
+        keys.append(jsonKey(query.queryItemValue("key", QUrl::FullyDecoded)));
+        byKeys = true;
+    }
+
+    auto documentRow = [this, includeDocs](const QString &id, const mq_fakeDocument &document)
+    {
+        QJsonObject row{ {"id", id}, {"key", id}, {"value", QJsonObject{ {"rev", document.rev} }} };
+        if(includeDocs)
+            row["doc"] = documentJson(id, document);
+        return row;
+    };
+
+    int total = 0;
+    for(const mq_fakeDocument &document : db)
+        total += document.deleted ? 0 : 1;
+
+    QJsonArray rows;
+    int offset = 0;
+
+    if(byKeys)
+    {
+        for(int i = skip; i < keys.count() && (limit < 0 || rows.count() < limit); i++)
+        {
+            const QString id = keys.at(i).toString();
+            auto it = db.constFind(id);
+
+            if(it == db.constEnd())
+                rows.append(QJsonObject{ {"key", id}, {"error", "not_found"} });
+            else if(it->deleted)
+                rows.append(QJsonObject{ {"id", id}, {"key", id}, {"value", QJsonObject{ {"rev", it->rev}, {"deleted", true} }},
+                                         {"doc", QJsonValue::Null} });
+            else
+                rows.append(documentRow(id, *it));
+        }
+    }
+    else
+    {
+        const QString startKey = param("startkey", "start_key");
+        const QString endKey = param("endkey", "end_key");
+        const QString start = startKey.isEmpty() ? QString() : jsonKey(startKey);
+        const QString end = endKey.isEmpty() ? QString() : jsonKey(endKey);
+
+        QStringList ids;
+        for(auto it = db.constBegin(); it != db.constEnd(); ++it)
+        {
+            if(!it->deleted)
+                ids << it.key();
+        }
+        if(descending)
+            std::reverse(ids.begin(), ids.end());
+
+        int skipped = 0;
+        for(const QString &id : ids)
+        {
+            const bool beforeStart = !startKey.isEmpty() && (descending ? id > start : id < start);
+            const bool afterEnd = !endKey.isEmpty() && (descending ? (inclusiveEnd ? id < end : id <= end)
+                                                                   : (inclusiveEnd ? id > end : id >= end));
+            if(beforeStart)
+            {
+                offset++;
+                continue;
+            }
+            if(afterEnd || (limit >= 0 && rows.count() >= limit))
+                break;
+            if(skipped < skip)
+            {
+                skipped++;
+                offset++;
+                continue;
+            }
+
+            rows.append(documentRow(id, db.value(id)));
+        }
+    }
+
+    return json(200, QJsonObject{ {"total_rows", total}, {"offset", offset}, {"rows", rows} });
+}
+
+mqfakecouch::mq_fakeResponse mqfakecouch::bulkDocs(const mq_fakeRequest &request, const QString &database)
+{
+    const QJsonArray docs = QJsonDocument::fromJson(request.body).object()["docs"].toArray();
+    mq_fakeDatabase &db = m_databases[database];
+
+    QJsonArray results;
+    for(const QJsonValue &value : docs)
+    {
+        const QJsonObject document = value.toObject();
+
+        QString id = document["_id"].toString();
+        if(id.isEmpty())
+            id = newUuid();
+
+        if(roll(m_options.conflictRate))
+        {
+            results.append(QJsonObject{ {"id", id}, {"error", "conflict"}, {"reason", "Document update conflict."} });
+            continue;
+        }
+
+        results.append(writeDocument(db, id, document, document["_rev"].toString(), document["_deleted"].toBool()));
+    }
+
+    return json(201, results);
+}
+
+mqfakecouch::mq_fakeResponse mqfakecouch::bulkGet(const mq_fakeRequest &request, const QString &database)
+{
+    const QJsonArray docs = QJsonDocument::fromJson(request.body).object()["docs"].toArray();
+    const mq_fakeDatabase &db = m_databases[database];
+
+    QJsonArray results;
+    for(const QJsonValue &value : docs)
+    {
+        const QString id = value.toObject()["id"].toString();
+        const QString rev = value.toObject()["rev"].toString();
+        auto it = db.constFind(id);
+
+        QJsonObject entry;
+        if(it != db.constEnd() && !it->deleted && (rev.isEmpty() || rev == it->rev))
+            entry = QJsonObject{ {"ok", documentJson(id, *it)} };
+        else
+            entry = QJsonObject{ {"error", QJsonObject{ {"id", id}, {"rev", rev.isEmpty() ? QString("undefined") : rev},
+                                                        {"error", "not_found"}, {"reason", "missing"} }} };
+
+        results.append(QJsonObject{ {"id", id}, {"docs", QJsonArray{ entry }} });
+    }
+
+    return json(200, QJsonObject{ {"results", results} });
+}
+
+QJsonObject mqfakecouch::writeDocument(mq_fakeDatabase &database, const QString &id, QJsonObject body, QString rev, bool deleted)
+{
+    auto it = database.constFind(id);
+    const bool exists = it != database.constEnd() && !it->deleted;
+    const QString current = it != database.constEnd() ? it->rev : QString();
+
+    //Updates name the leaf revision, new documents none (or the tombstone's)
+    if((exists && rev != current) || (!exists && !rev.isEmpty() && rev != current))
+        return QJsonObject{ {"id", id}, {"error", "conflict"}, {"reason", "Document update conflict."} };
+
+    if(deleted && !exists)
+        return QJsonObject{ {"id", id}, {"error", "not_found"}, {"reason", "missing"} };
+
+    mq_fakeDocument document = it != database.constEnd() ? *it : mq_fakeDocument();
+
+    body.remove("_id");
+    body.remove("_rev");
+    body.remove("_deleted");
+
+    //Attachments left out of an update are dropped, stubs keep the stored ones
+    QMap<QString, mq_fakeAttachment> attachments;
+    const QJsonObject inlined = body.take("_attachments").toObject();
+    for(auto attachment = inlined.constBegin(); attachment != inlined.constEnd(); ++attachment)
+    {
+        const QJsonObject entry = attachment.value().toObject();
+
+        if(entry["stub"].toBool() && document.attachments.contains(attachment.key()))
+            attachments.insert(attachment.key(), document.attachments.value(attachment.key()));
+        else
+            attachments.insert(attachment.key(), mq_fakeAttachment{ entry["content_type"].toString().toLatin1(),
+                                                                    QByteArray::fromBase64(entry["data"].toString().toLatin1()) });
+    }
+
+    document.body = deleted ? QJsonObject() : body;
+    document.attachments = deleted ? QMap<QString, mq_fakeAttachment>() : attachments;
+    document.deleted = deleted;
+    document.rev = nextRev(current, body);
+
+    database.insert(id, document);
+
+    return QJsonObject{ {"ok", true}, {"id", id}, {"rev", document.rev} };
+}
+
+QJsonObject mqfakecouch::documentJson(const QString &id, const mq_fakeDocument &document) const
+{
+    QJsonObject object = document.body;
+    object["_id"] = id;
+    object["_rev"] = document.rev;
+
+    if(!document.attachments.isEmpty())
+    {
+        QJsonObject stubs;
+        for(auto it = document.attachments.constBegin(); it != document.attachments.constEnd(); ++it)
+        {
+            stubs.insert(it.key(), QJsonObject{ {"content_type", QString::fromLatin1(it->contentType)},
+                                                {"digest", "md5-" + QString::fromLatin1(attachmentDigest(it->data))},
+                                                {"length", it->data.size()}, {"revpos", 1}, {"stub", true} });
+        }
+        object["_attachments"] = stubs;
+    }
+
+    return object;
+}
+
+mqfakecouch::mq_fakeResponse mqfakecouch::writeResponse(const QJsonObject &result, int status)
+{
+    const QString failure = result["error"].toString();
+    if(failure == "conflict")
+        return error(409, failure, result["reason"].toString());
+    if(!failure.isEmpty())
+        return error(404, failure, result["reason"].toString());
+
+    mq_fakeResponse response = json(status, result);
+    response.headers << qMakePair(QByteArray("ETag"), "\"" + result["rev"].toString().toLatin1() + "\"");
+    return response;
+}
+
+mqfakecouch::mq_fakeResponse mqfakecouch::json(int status, const QJsonValue &body)
+{
+    QJsonDocument document = body.isArray() ? QJsonDocument(body.toArray()) : QJsonDocument(body.toObject());
+
+    //Filler to test large responses, arrays are left alone
+    if(m_options.padding > 0 && body.isObject())
+    {
+        QJsonObject object = body.toObject();
+        object["padding"] = QString(m_options.padding, QChar('x'));
+        document = QJsonDocument(object);
+    }
+
+    return mq_fakeResponse{ status, document.toJson(QJsonDocument::Compact),
+                            { qMakePair(QByteArray("Content-Type"), QByteArray("application/json")) } };
+}
+
+mqfakecouch::mq_fakeResponse mqfakecouch::error(int status, const QString &error, const QString &reason)
+{
+    const QJsonObject body{ {"error", error}, {"reason", reason} };
+
+    return mq_fakeResponse{ status, QJsonDocument(body).toJson(QJsonDocument::Compact),
+                            { qMakePair(QByteArray("Content-Type"), QByteArray("application/json")) } };
+}
+
+QString mqfakecouch::nextRev(const QString &rev, const QJsonObject &body)
+{
+    const int generation = rev.section('-', 0, 0).toInt() + 1;
+    const QByteArray hash = QCryptographicHash::hash(rev.toLatin1() + QJsonDocument(body).toJson(QJsonDocument::Compact),
+                                                     QCryptographicHash::Md5).toHex();
+
+    return QString::number(generation) + "-" + QString::fromLatin1(hash);
+}
+
+QByteArray mqfakecouch::attachmentDigest(const QByteArray &data)
+{
+    return QCryptographicHash::hash(data, QCryptographicHash::Md5).toBase64();
+}
+
+QByteArray mqfakecouch::inflate(const QByteArray &data, bool *ok)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    //Window bits 15 + 32 accepts gzip and zlib headers
+    *ok = inflateInit2(&stream, 15 + 32) == Z_OK;
+    if(!*ok)
+        return QByteArray();
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    stream.avail_in = uInt(data.size());
+
+    QByteArray result;
+    char chunk[64 * 1024];
+    int status;
+
+    do
+    {
+        stream.next_out = reinterpret_cast<Bytef*>(chunk);
+        stream.avail_out = sizeof(chunk);
+
+        status = ::inflate(&stream, Z_NO_FLUSH);
+        if(status != Z_OK && status != Z_STREAM_END)
+            break;
+
+        result.append(chunk, int(sizeof(chunk) - stream.avail_out));
+    }
+    while(status != Z_STREAM_END);
+
+    inflateEnd(&stream);
+
+    *ok = status == Z_STREAM_END;
+    return result;
+}
+
+QString mqfakecouch::newUuid()
+{
+    QString uuid;
+    for(int i = 0; i < 4; i++)
+        uuid += QString::number(quint32(m_random()), 16).rightJustified(8, '0');
+
+    return uuid;
+}
+
+bool mqfakecouch::roll(double rate)
+{
+    if(rate <= 0)
+        return false;
+
+    return std::uniform_real_distribution<double>(0, 1)(m_random) < rate;
+}
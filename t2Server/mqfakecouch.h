@@ -0,0 +1,140 @@
+#ifndef MQFAKECOUCH_H
+#define MQFAKECOUCH_H
+
+#include <QObject>
+
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtNetwork/QHostAddress>
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QUrlQuery>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonValue>
+
+#include <random>
+
+typedef struct _mq_fakeOptions{
+    int latency = 0;             //ms added to every response
+    int jitter = 0;              //ms, uniformly added on top of latency
+    qint64 bytesPerSecond = 0;   //response bandwidth shared by all connections, 0 is unlimited
+    double conflictRate = 0;     //share of document writes answered with 409
+    double errorRate = 0;        //share of requests answered with 500
+    double timeoutRate = 0;      //share of requests that never get a response
+    int padding = 0;             //bytes of filler added to JSON object responses
+    quint32 seed = 1;            //random source of jitter and injected faults
+} _mq_fakeOptions;
+
+/**
+ * @brief In-memory stand-in for a CouchDB server
+ *
+ * Implements the endpoints mqcouch uses: /, _all_dbs, _uuids, databases,
+ * documents, _all_docs, _bulk_docs, _bulk_get and attachments with Range.
+ * Latency, bandwidth and faults are configurable and driven by a seeded
+ * random source, so runs are reproducible without a real server.
+ */
+class mqfakecouch : public QObject
+{
+    Q_OBJECT
+public:
+    explicit mqfakecouch(_mq_fakeOptions options = _mq_fakeOptions(), QObject *parent = 0);
+
+    /// @param port 0 picks a free port, see url()
+    bool listen(const QHostAddress &address = QHostAddress::LocalHost, quint16 port = 0);
+
+    /// @return server url for mqcouch, ex. http://127.0.0.1:5984
+    QString url() const;
+
+    void setOptions(_mq_fakeOptions options);
+    _mq_fakeOptions options() const { return m_options; }
+
+    quint64 requestCount() const { return m_requests; }
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onDisconnected();
+
+private:
+    typedef struct mq_fakeRequest{
+        QByteArray verb;
+        QStringList path;
+        QUrlQuery query;
+        QHash<QByteArray, QByteArray> headers;   //lower case names
+        QByteArray body;
+    } mq_fakeRequest;
+
+    typedef struct mq_fakeResponse{
+        int status;
+        QByteArray body;
+        QList<QPair<QByteArray, QByteArray>> headers;
+    } mq_fakeResponse;
+
+    typedef struct mq_fakeAttachment{
+        QByteArray contentType;
+        QByteArray data;
+    } mq_fakeAttachment;
+
+    typedef struct mq_fakeDocument{
+        QJsonObject body;
+        QString rev;
+        bool deleted = false;
+        QMap<QString, mq_fakeAttachment> attachments;
+    } mq_fakeDocument;
+
+    typedef QMap<QString, mq_fakeDocument> mq_fakeDatabase;
+
+    void process(QTcpSocket *socket);
+    static bool parseRequest(QByteArray *buffer, mq_fakeRequest *request);
+    void send(QTcpSocket *socket, const mq_fakeResponse &response, bool head);
+
+    mq_fakeResponse handle(const mq_fakeRequest &request);
+    mq_fakeResponse handleDatabase(const mq_fakeRequest &request, const QString &database);
+    mq_fakeResponse handleDocument(const mq_fakeRequest &request, const QString &database, const QString &id);
+    mq_fakeResponse handleAttachment(const mq_fakeRequest &request, const QString &database, const QString &id, const QString &name);
+    mq_fakeResponse allDocs(const mq_fakeRequest &request, const QString &database);
+    mq_fakeResponse bulkDocs(const mq_fakeRequest &request, const QString &database);
+    mq_fakeResponse bulkGet(const mq_fakeRequest &request, const QString &database);
+
+    //Stores a document write, returns the new revision or an error object
+    QJsonObject writeDocument(mq_fakeDatabase &database, const QString &id, QJsonObject body, QString rev, bool deleted);
+    QJsonObject documentJson(const QString &id, const mq_fakeDocument &document) const;
+
+    mq_fakeResponse writeResponse(const QJsonObject &result, int status);
+    mq_fakeResponse json(int status, const QJsonValue &body);
+    mq_fakeResponse error(int status, const QString &error, const QString &reason);
+
+    static QString nextRev(const QString &rev, const QJsonObject &body);
+    static QByteArray attachmentDigest(const QByteArray &data);
+    static QByteArray inflate(const QByteArray &data, bool *ok);
+    QString newUuid();
+    bool roll(double rate);
+
+    _mq_fakeOptions m_options;
+    QTcpServer *m_server;
+
+    QHash<QTcpSocket*, QByteArray> m_buffers;
+    //Connections waiting for their response, requests are answered one at a time per connection
+    QSet<QTcpSocket*> m_busy;
+
+    QMap<QString, mq_fakeDatabase> m_databases;
+
+    std::mt19937 m_random;
+    QElapsedTimer m_clock;
+    qint64 m_linkFreeAt = 0;
+    quint64 m_requests = 0;
+    QString m_uuid;
+};
+
+#endif // MQFAKECOUCH_H
@@ -0,0 +1,20 @@
+QT += core network
+QT -= gui
+
+CONFIG += c++14
+
+TARGET = t2Server
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+LIBS += -lz
+
+SOURCES += main.cpp \
+    mqfakecouch.cpp
+
+HEADERS += \
+    mqfakecouch.h
+
+DEFINES += QT_DEPRECATED_WARNINGS